@@ -0,0 +1,144 @@
+/* -*- Mode: C; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+/*
+ * bands.c: split work on an image into bands of rows,
+ * and do the bands at the same time on different processors.
+ *
+ * Copyright 2026 by Akkana Peck.
+ * You are free to use or modify this code under the Gnu Public License.
+ */
+
+/* The bands are split by output row, so no two threads ever write
+ * the same pixels and nothing needs locking except the count of
+ * bands still running. The calling thread does the first band itself
+ * and then waits for the rest, so RunInBands is finished with
+ * everything by the time it returns.
+ *
+ * The prefetch threads rotate and scale too, so RunInBands may be
+ * called from several threads at once. They share one pool.
+ */
+
+#include "pho.h"
+
+#include <stdio.h>
+
+/* How many threads to use: 0 means one per processor. */
+int gThreads = 0;
+
+#define MAX_BANDS 64
+
+/* Bands smaller than this aren't worth handing to another thread */
+#define MIN_BAND_ROWS 32
+
+typedef struct {
+    GMutex lock;
+    GCond done;
+    int remaining;
+} BandSet;
+
+typedef struct {
+    BandFunc func;
+    gpointer data;
+    int firstRow, endRow;
+    BandSet* set;
+} Band;
+
+static GThreadPool* sPool = 0;
+static int sPoolFailed = 0;
+static GMutex sPoolLock;
+
+static int NumThreads()
+{
+    int n = (gThreads > 0 ? gThreads : (int)g_get_num_processors());
+    if (n < 1)
+        n = 1;
+    if (n > MAX_BANDS)
+        n = MAX_BANDS;
+    return n;
+}
+
+static void FinishBand(Band* band)
+{
+    g_mutex_lock(&band->set->lock);
+    if (--band->set->remaining == 0)
+        g_cond_signal(&band->set->done);
+    g_mutex_unlock(&band->set->lock);
+}
+
+static void BandWork(gpointer data, gpointer user_data)
+{
+    Band* band = (Band*)data;
+
+    band->func(band->data, band->firstRow, band->endRow);
+    FinishBand(band);
+}
+
+/* The calling thread counts as one, so the pool only needs the rest. */
+static GThreadPool* GetPool()
+{
+    GThreadPool* pool;
+
+    g_mutex_lock(&sPoolLock);
+    if (!sPool && !sPoolFailed) {
+        GError* err = 0;
+        sPool = g_thread_pool_new(BandWork, 0, NumThreads() - 1, FALSE, &err);
+        if (!sPool) {
+            fprintf(stderr, "Couldn't start band threads: %s\n",
+                    err ? err->message : "unknown error");
+            if (err)
+                g_error_free(err);
+            sPoolFailed = 1;
+        }
+    }
+    pool = sPool;
+    g_mutex_unlock(&sPoolLock);
+    return pool;
+}
+
+void RunInBands(BandFunc func, gpointer data, int rows, int granularity)
+{
+    Band bands[MAX_BANDS];
+    BandSet set;
+    GThreadPool* pool;
+    int nbands = NumThreads();
+    int bandRows, i;
+
+    if (granularity < 1)
+        granularity = 1;
+    if (nbands > rows / MIN_BAND_ROWS)
+        nbands = rows / MIN_BAND_ROWS;
+    if (nbands <= 1 || !(pool = GetPool())) {
+        func(data, 0, rows);
+        return;
+    }
+
+    /* Round bands up to a multiple of granularity rows */
+    bandRows = (rows + nbands - 1) / nbands;
+    bandRows = (bandRows + granularity - 1) / granularity * granularity;
+    nbands = (rows + bandRows - 1) / bandRows;
+
+    g_mutex_init(&set.lock);
+    g_cond_init(&set.done);
+    set.remaining = nbands;
+
+    for (i = 0; i < nbands; ++i) {
+        bands[i].func = func;
+        bands[i].data = data;
+        bands[i].firstRow = i * bandRows;
+        bands[i].endRow = MIN(rows, (i + 1) * bandRows);
+        bands[i].set = &set;
+    }
+
+    /* If the pool won't take one, just do it here */
+    for (i = 1; i < nbands; ++i)
+        if (!g_thread_pool_push(pool, &bands[i], 0))
+            BandWork(&bands[i], 0);
+    BandWork(&bands[0], 0);
+
+    g_mutex_lock(&set.lock);
+    while (set.remaining > 0)
+        g_cond_wait(&set.done, &set.lock);
+    g_mutex_unlock(&set.lock);
+
+    g_cond_clear(&set.done);
+    g_mutex_clear(&set.lock);
+}
@@ -10,6 +10,8 @@
 #include "phoexif.h"
 
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 
 struct ExifTypes_s ExifLabels[] =
 {
@@ -34,9 +36,19 @@ struct ExifTypes_s ExifLabels[] =
     { "Thumbnail Size", ExifInt }
 };
 
+/* Which file ExifReadInfo() last read */
+static char* sInfoFile = 0;
+
 void ExifReadInfo(char* filename)
 {
     ProcessFile(filename);
+    free(sInfoFile);
+    sInfoFile = strdup(filename);
+}
+
+int ExifInfoIsFor(const char* filename)
+{
+    return (sInfoFile && !strcmp(sInfoFile, filename));
 }
 
 static char buf[BUFSIZ];
@@ -110,6 +122,17 @@ const char* ExifGetString(ExifFields_e field)
     return 0;
 }
 
+/* jhead's OrientRot says how to rotate each orientation,
+ * leaving the flip to jpegtran; for the mirrored ones (2, 4, 5, 7)
+ * these are the rotations that go with a left-right flip.
+ */
+static int sOrientRot[9] = {
+    0, 0, 0, 180, 180, 270, 90, 90, 270
+};
+static int sOrientMirror[9] = {
+    0, 0, 1, 0, 1, 1, 0, 1, 0
+};
+
 int ExifGetInt(ExifFields_e field)
 {
     if (!HasExif()) {
@@ -120,7 +143,7 @@ int ExifGetInt(ExifFields_e field)
     switch (field)
     {
       case ExifOrientation:
-          return OrientRot[ImageInfo.Orientation];
+          return ExifOrientationRot(ImageInfo.Orientation);
       case ExifColor:
           return ImageInfo.IsColor;
       case ExifFlash:
@@ -168,7 +191,7 @@ float ExifGetFloat(ExifFields_e field)
     switch (field)
     {
       case ExifOrientation:
-          return (float)OrientRot[ImageInfo.Orientation];
+          return (float)ExifOrientationRot(ImageInfo.Orientation);
       case ExifColor:
           return (float)ImageInfo.IsColor;
       case ExifFlash:
@@ -206,3 +229,44 @@ float ExifGetFloat(ExifFields_e field)
     return 0;
 }
 
+int ExifOrientationRot(int orientation)
+{
+    if (orientation < 0 || orientation > 8)
+        return 0;
+    return sOrientRot[orientation];
+}
+
+int ExifOrientationMirror(int orientation)
+{
+    if (orientation < 0 || orientation > 8)
+        return 0;
+    return sOrientMirror[orientation];
+}
+
+int ExifIsMirrored()
+{
+    if (!HasExif())
+        return 0;
+    return ExifOrientationMirror(ImageInfo.Orientation);
+}
+
+const unsigned char* ExifGetThumbnail(unsigned int* size)
+{
+    if (!HasExif() || !ImageInfo.ThumbnailPointer
+        || ImageInfo.ThumbnailSize == 0) {
+        *size = 0;
+        return 0;
+    }
+    *size = ImageInfo.ThumbnailSize;
+    return ImageInfo.ThumbnailPointer;
+}
+
+void ExifGetImageSize(int* width, int* height)
+{
+    if (!HasExif()) {
+        *width = *height = 0;
+        return;
+    }
+    *width = ImageInfo.Width;
+    *height = ImageInfo.Height;
+}
@@ -52,6 +52,9 @@ typedef enum
  */
 extern void ExifReadInfo(char* filename);
 
+/* Whether the info ExifReadInfo() last read is for this file */
+extern int ExifInfoIsFor(const char* filename);
+
 /*
  * Do selected operations to one file at a time.
 */
@@ -72,6 +75,27 @@ extern const char* ExifGetString(ExifFields_e field);
 extern         int ExifGetInt(ExifFields_e field);
 extern       float ExifGetFloat(ExifFields_e field);
 
+/* Translate a raw EXIF orientation (1-8) into degrees of rotation,
+ * the same way ExifGetInt(ExifOrientation) would. Unlike the ExifGet
+ * routines, this doesn't need ExifReadInfo(), so any thread can use it.
+ * Orientations 2, 4, 5 and 7 are mirror images: flip the image
+ * left to right (ExifOrientationMirror), then rotate it.
+ */
+extern int ExifOrientationRot(int orientation);
+extern int ExifOrientationMirror(int orientation);
+
+/* Whether the last file ExifReadInfo() read is a mirror image */
+extern int ExifIsMirrored();
+
+/* The embedded JPEG thumbnail of the last file ExifReadInfo() read,
+ * or 0 if it doesn't have one. This points into jhead's own buffers,
+ * so it's only good until the next ExifReadInfo().
+ */
+extern const unsigned char* ExifGetThumbnail(unsigned int* size);
+
+/* Pixel size of the whole image, from the JPEG header. */
+extern void ExifGetImageSize(int* width, int* height);
+
 
 #endif /* PHOEXIF_H */
     
@@ -159,9 +159,11 @@ void UpdateInfoDialog()
     for (i=0, mask=1; i<10; ++i, mask <<= 1)
         SetInfoDialogToggle(i, (flags & mask) != 0);
 
-    /* Loop over the various EXIF elements.
-     * Expect we already called ExifReadInfo, back in LoadImageFromFile.
+    /* Loop over the various EXIF elements. Loading only reads the
+     * EXIF info the first time, so it may be some other image's.
      */
+    if (!ExifInfoIsFor(gCurImage->filename))
+        ExifReadInfo(gCurImage->filename);
     if (HasExif(gCurImage))
         gtk_widget_set_sensitive(InfoExifContainer, TRUE);
     else
@@ -17,11 +17,15 @@
 #include <unistd.h>
 #include <string.h>
 #include <ctype.h>
+#include <time.h>
 
 char * gCapFileFormat = "Captions";
 
 /* randomize order in which images will be shown? */
 int gRandomOrder = 0;
+/* and with what seed, if -RN gave one; otherwise the time */
+static int sHaveSeed = 0;
+static guint32 sRandomSeed = 0;
 
 /* Toggle a variable between two modes, preferring the first.
  * If it's anything but mode1 it will end up as mode1.
@@ -185,22 +189,22 @@ gint HandleGlobalKeys(GtkWidget* widget, GdkEventKey* event)
           if (gDelayMillis > 0) {
               gDelayMillis = 0;
           }
-          else if (NextImage() != 0) {
-              if (Prompt("Quit pho?", "Quit", "Continue", "qx \n", "cn") != 0)
-                  EndSession();
-          }
+          else
+              QueueNavigation(1);
           return TRUE;
       case GDK_BackSpace:
       case GDK_Page_Up:
       case GDK_KP_Page_Up:
-          PrevImage();
+          QueueNavigation(-1);
           return TRUE;
       case GDK_Home:
+          CancelNavigation();
           gCurImage = 0;
           NextImage();
           return TRUE;
       case GDK_End:
-          gCurImage = gFirstImage->prev;
+          CancelNavigation();
+          gCurImage = NthImage(CountImages() - 1);
           ThisImage();
           return TRUE;
       case GDK_n:   /* Get out of any weird display modes */
@@ -397,8 +401,38 @@ static void CheckArg(char* arg)
             else Usage();
             if (gDebug)
                 printf("Slideshow delay %d milliseconds\n", gDelayMillis);
+        } else if (*arg == 'C') {
+            /* Image cache size in megabytes, e.g. pho -C512 */
+            if (isdigit(arg[1]))
+                gCacheMegabytes = atoi(arg+1);
+            else Usage();
+            if (gDebug)
+                printf("Image cache %d megabytes\n", gCacheMegabytes);
+        } else if (*arg == 'j') {
+            /* Threads to rotate and scale with, e.g. pho -j4 */
+            if (isdigit(arg[1]))
+                gThreads = atoi(arg+1);
+            else Usage();
+            if (gDebug)
+                printf("Using %d threads\n", gThreads);
+        } else if (*arg == 'F') {
+            /* Which filter to shrink images with: pho -Fpho or -Fgdk */
+            if (!strcmp(arg+1, "pho"))
+                gScaleFilter = PHO_FILTER_PHO;
+            else if (!strcmp(arg+1, "gdk"))
+                gScaleFilter = PHO_FILTER_GDK;
+            else Usage();
+            if (gDebug)
+                printf("Scaling with the %s filter\n", arg+1);
+
+            /* The rest of the arg was the filter name */
+            return;
+        } else if (*arg == 'M') {
+            gKeepMasters = 1;
         } else if (*arg == 'r') {
             gRepeat = 1;
+        } else if (*arg == 't') {
+            gThumbPreview = 1;
         } else if (*arg == 'c') {
             gCapFileFormat = strdup(arg+1);
             if (gDebug)
@@ -410,6 +444,11 @@ static void CheckArg(char* arg)
             return;
         } else if (*arg == 'R') {
             gRandomOrder = 1;
+            /* Seed for the random order, e.g. pho -R42 */
+            if (isdigit(arg[1])) {
+                sRandomSeed = (guint32)strtoul(arg+1, 0, 10);
+                sHaveSeed = 1;
+            }
         }
     }
 }
@@ -444,7 +483,7 @@ int main(int argc, char** argv)
         Usage();
 
     if (gRandomOrder)
-        ShuffleImages();
+        ShuffleImages(sHaveSeed ? sRandomSeed : (guint32)time(NULL));
 
     /* Initialize some variables associated with the notes flags */
     InitNotes();
@@ -56,9 +56,21 @@ static GtkWidget *sDrawingArea = 0;
  */
 static int sExposed = 0;
 
+/* Redraws are scheduled rather than done on the spot, and done at most
+ * once a frame: a burst of requests (e.g. while dragging) gets one paint.
+ */
+#define FRAME_USEC (G_USEC_PER_SEC / 60)
+static int sDrawPending = 0;      /* someone asked for a redraw */
+static int sInFrame = 0;          /* DrawFrame is processing updates */
+static guint sDrawSource = 0;
+static gint64 sLastFrame = 0;
+static int sDrawsRequested = 0;
+static int sDrawsDone = 0;
+
 /* forward definitions */
 static void NewWindow();
 static void MoveWin2Monitor(int whichmon, int x, int y);
+static void SetPaintingMode();
 
 static void hide_cursor(GtkWidget* w)
 {
@@ -126,15 +138,30 @@ static void AdjustScreenSize()
     ScaleAndRotate(gCurImage, 0);
 }
 
+/* How big the window should be to show the current image.
+ * A tiled image can be far bigger than the screen, but there's
+ * no point in a window bigger than what can be seen.
+ */
+static void GetWindowSize(int* width, int* height)
+{
+    *width = gCurImage->curWidth;
+    *height = gCurImage->curHeight;
+    if (TilesActive()) {
+        if (*width > gMonitorWidth)
+            *width = gMonitorWidth;
+        if (*height > gMonitorHeight)
+            *height = gMonitorHeight;
+    }
+}
+
 static void CenterWindow(GtkWidget* win)
 {
     gint w, h;
     if (gDebug) printf("CenterWindow\n");
-    gtk_window_get_size(GTK_WINDOW(gWin), &w, &h);
+    GetWindowSize(&w, &h);
     gtk_window_set_gravity(GTK_WINDOW(win), GDK_GRAVITY_CENTER);
     gtk_window_move(GTK_WINDOW(win),
-                    (gMonitorWidth - gCurImage->curWidth)/2,
-                    (gMonitorHeight - gCurImage->curHeight)/2);
+                    (gMonitorWidth - w)/2, (gMonitorHeight - h)/2);
     gtk_window_set_gravity(GTK_WINDOW(win), GDK_GRAVITY_NORTH_WEST);
 }
 
@@ -244,6 +271,7 @@ int SetViewModes(int dispmode, int scalemode, double scalefactor)
 
     if (dispmode != gDisplayMode) {
         gDisplayMode = dispmode;
+        SetPaintingMode();
         if (gWin && sDrawingArea && GTK_WIDGET_MAPPED(gWin))
             /* Changing an existing window */
         {
@@ -290,101 +318,452 @@ int SetViewModes(int dispmode, int scalemode, double scalefactor)
     return 0;
 }
 
-/* DrawImage is called from the expose callback.
- * It assumes we already have the image in gImage.
+/* Where the upper left corner of the image goes in the drawing area.
+ * That's always 0, 0 except in presentation mode, where the image
+ * is centered and may have been dragged, or for a tiled image,
+ * which is centered in the window and can be dragged around in it.
  */
-void DrawImage()
+static void GetImageOrigin(int* dstX, int* dstY)
 {
-    int dstX = 0, dstY = 0;
-    char title[BUFSIZ];
-#   define TITLELEN ((sizeof title) / (sizeof *title))
+    gint width, height;
 
-    if (gDebug) {
-        printf("DrawImage %s, %dx%d\n", gCurImage->filename,
-               gCurImage->curWidth, gCurImage->curHeight);
+    *dstX = *dstY = 0;
+    if (gDisplayMode != PHO_DISPLAY_PRESENTATION) {
+        int centerX, centerY;
+
+        if (!TilesActive())
+            return;
+
+        /* Keep the window covered: the image is bigger than it. */
+        gdk_drawable_get_size(sDrawingArea->window, &width, &height);
+        centerX = (width - gCurImage->curWidth) / 2;
+        centerY = (height - gCurImage->curHeight) / 2;
+        *dstX = centerX + sDragOffsetX;
+        *dstY = centerY + sDragOffsetY;
+        if (*dstX < width - gCurImage->curWidth)
+            *dstX = width - gCurImage->curWidth;
+        if (*dstX > 0)
+            *dstX = 0;
+        if (*dstY < height - gCurImage->curHeight)
+            *dstY = height - gCurImage->curHeight;
+        if (*dstY > 0)
+            *dstY = 0;
+
+        /* So dragging back from past an edge responds right away */
+        sDragOffsetX = *dstX - centerX;
+        sDragOffsetY = *dstY - centerY;
+        return;
     }
 
-    if (gImage == 0 || gWin == 0 || sDrawingArea == 0) return;
-    if (!sExposed) return;
-    if (!GTK_WIDGET_MAPPED(gWin)) return;
+    /* Center the image. This has to be done according to
+     * the current window size, not the phys monitor size,
+     * because in the xinerama case, gtk_window_fullscreen()
+     * only fullscreens the current monitor, not all of them.
+     */
+    gtk_window_get_size(GTK_WINDOW(gWin), &width, &height);
 
-    if (gDisplayMode == PHO_DISPLAY_PRESENTATION) {
-        gint width, height;
-        gdk_window_clear(sDrawingArea->window);
+    /* If we have a presentation screen size set (e.g. for a projector
+     * that has a different resolution from our native monitor),
+     * Fudge the screen size and center based on a virtual screen
+     * starting in the upper left corner of our current screen.
+     * That way, it will center on the projector or other device.
+     */
+    if (gPresentationWidth > 0)
+        width = gPresentationWidth;
+    if (gPresentationHeight > 0)
+        height = gPresentationHeight;
 
-        /* Center the image. This has to be done according to
-         * the current window size, not the phys monitor size,
-         * because in the xinerama case, gtk_window_fullscreen()
-         * only fullscreens the current monitor, not all of them.
-         */
-        gtk_window_get_size(GTK_WINDOW(gWin), &width, &height);
+    *dstX = (width - gCurImage->curWidth) / 2 + sDragOffsetX;
+    *dstY = (height - gCurImage->curHeight) / 2 + sDragOffsetY;
 
-        /* If we have a presentation screen size set (e.g. for a projector
-         * that has a different resolution from our native monitor),
-         * Fudge the screen size and center based on a virtual screen
-         * starting in the upper left corner of our current screen.
-         * That way, it will center on the projector or other device.
-         */
-        if (gPresentationWidth > 0)
-            width = gPresentationWidth;
-        if (gPresentationHeight > 0)
-            height = gPresentationHeight;
+    /* But we probably shouldn't allow dragging the image
+     * completely off the screen -- just drag to the point where
+     * a corner is visible.
+     */
+    /* Left edge */
+    if (gCurImage->curWidth > gMonitorWidth
+        && *dstX < gMonitorWidth - gCurImage->curWidth)
+        *dstX = gMonitorWidth - gCurImage->curWidth;
+    else if (gCurImage->curWidth <= gMonitorWidth && *dstX <= 0)
+        *dstX = 0;
+
+    /* Top edge */
+    if (gCurImage->curHeight > gMonitorHeight
+        && *dstY < gMonitorHeight - gCurImage->curHeight)
+        *dstY = gMonitorHeight - gCurImage->curHeight;
+    else if (gCurImage->curHeight <= gMonitorHeight && *dstY <= 0)
+        *dstY = 0;
+
+    /* Right edge */
+    if (gCurImage->curWidth < gMonitorWidth
+        && *dstX > gMonitorWidth - gCurImage->curWidth)
+        *dstX = gMonitorWidth - gCurImage->curWidth;
+    else if (gCurImage->curWidth >= gMonitorWidth
+             && *dstX > 0)
+        *dstX = 0;
+
+    /* Bottom edge */
+    if (gCurImage->curHeight < gMonitorHeight
+        && *dstY > gMonitorHeight - gCurImage->curHeight)
+        *dstY = gMonitorHeight - gCurImage->curHeight;
+    else if (gCurImage->curHeight >= gMonitorHeight
+             && *dstY > 0)
+        *dstY = 0;
+
+    /* XXX Would be good to reset sDragOffsetX and sDragOffsetY
+     * in these cases so they don't get crazily out of kilter.
+     */
+}
+
+/* gImage as a cairo surface, for DrawRotatedArea: converting the
+ * whole pixbuf for every rectangle drawn would cost far more than
+ * drawing the rectangle. Like sPixmapImage below, sSurfaceImage is
+ * a weak pointer to the pixbuf it was made from.
+ */
+static cairo_surface_t* sSurface = 0;
+static GdkPixbuf* sSurfaceImage = 0;
 
-        dstX = (width - gCurImage->curWidth) / 2 + sDragOffsetX;
-        dstY = (height - gCurImage->curHeight) / 2 + sDragOffsetY;
+static void ForgetImageSurface()
+{
+    if (sSurfaceImage)
+        g_object_remove_weak_pointer(G_OBJECT(sSurfaceImage),
+                                     (gpointer*)&sSurfaceImage);
+    sSurfaceImage = 0;
+    if (sSurface)
+        cairo_surface_destroy(sSurface);
+    sSurface = 0;
+}
 
-        /* But we probably shouldn't allow dragging the image
-         * completely off the screen -- just drag to the point where
-         * a corner is visible.
-         */
-        /* Left edge */
-        if (gCurImage->curWidth > gMonitorWidth
-            && dstX < gMonitorWidth - gCurImage->curWidth)
-            dstX = gMonitorWidth - gCurImage->curWidth;
-        else if (gCurImage->curWidth <= gMonitorWidth && dstX <= 0)
-            dstX = 0;
-
-        /* Top edge */
-        if (gCurImage->curHeight > gMonitorHeight
-            && dstY < gMonitorHeight - gCurImage->curHeight)
-            dstY = gMonitorHeight - gCurImage->curHeight;
-        else if (gCurImage->curHeight <= gMonitorHeight && dstY <= 0)
-            dstY = 0;
-
-        /* Right edge */
-        if (gCurImage->curWidth < gMonitorWidth
-            && dstX > gMonitorWidth - gCurImage->curWidth)
-            dstX = gMonitorWidth - gCurImage->curWidth;
-        else if (gCurImage->curWidth >= gMonitorWidth
-                 && dstX > 0)
-            dstX = 0;
-
-        /* Bottom edge */
-        if (gCurImage->curHeight < gMonitorHeight
-            && dstY > gMonitorHeight - gCurImage->curHeight)
-            dstY = gMonitorHeight - gCurImage->curHeight;
-        else if (gCurImage->curHeight >= gMonitorHeight
-                 && dstY > 0)
-            dstY = 0;
-
-        /* XXX Would be good to reset sDragOffsetX and sDragOffsetY
-         * in these cases so they don't get crazily out of kilter.
-         */
+/* Copy the width x height part of gImage at x, y into sSurface */
+static void UpdateImageSurface(int x, int y, int width, int height)
+{
+    GdkPixbuf* part = gdk_pixbuf_new_subpixbuf(gImage, x, y, width, height);
+    cairo_t* cr;
+
+    if (!part)
+        return;
+    cr = cairo_create(sSurface);
+    cairo_set_operator(cr, CAIRO_OPERATOR_SOURCE);
+    gdk_cairo_set_source_pixbuf(cr, part, x, y);
+    cairo_paint(cr);
+    cairo_destroy(cr);
+    g_object_unref(part);
+}
+
+/* gImage as a cairo surface, made once per gImage, or 0 */
+static cairo_surface_t* ImageSurface()
+{
+    int width, height;
+
+    if (sSurface && sSurfaceImage == gImage)
+        return sSurface;
+    ForgetImageSurface();
+
+    width = gdk_pixbuf_get_width(gImage);
+    height = gdk_pixbuf_get_height(gImage);
+    sSurface = cairo_image_surface_create(gdk_pixbuf_get_has_alpha(gImage)
+                                          ? CAIRO_FORMAT_ARGB32
+                                          : CAIRO_FORMAT_RGB24,
+                                          width, height);
+    if (cairo_surface_status(sSurface) != CAIRO_STATUS_SUCCESS) {
+        cairo_surface_destroy(sSurface);
+        sSurface = 0;
+        return 0;
     }
+    UpdateImageSurface(0, 0, width, height);
+    sSurfaceImage = gImage;
+    g_object_add_weak_pointer(G_OBJECT(sSurfaceImage),
+                              (gpointer*)&sSurfaceImage);
+    return sSurface;
+}
+
+/* Draw gImage rotated clockwise by rot degrees, with the upper left
+ * corner of the rotated image at dstX, dstY, but only the part
+ * inside the given rectangle of the window.
+ */
+static void DrawRotatedArea(GdkDrawable* drawable, int rot,
+                            int dstX, int dstY,
+                            int x, int y, int width, int height)
+{
+    cairo_surface_t* surface = ImageSurface();
+    cairo_t* cr = gdk_cairo_create(drawable);
+
+    cairo_rectangle(cr, x, y, width, height);
+    cairo_clip(cr);
+    cairo_translate(cr, dstX, dstY);
+
+    /* Rotating around the origin swings the image up or left
+     * out of the window, so move it back first.
+     */
+    if (rot == 90)
+        cairo_translate(cr, gdk_pixbuf_get_height(gImage), 0);
+    else if (rot == 180)
+        cairo_translate(cr, gdk_pixbuf_get_width(gImage),
+                        gdk_pixbuf_get_height(gImage));
+    else if (rot == 270)
+        cairo_translate(cr, 0, gdk_pixbuf_get_width(gImage));
+    cairo_rotate(cr, rot * G_PI / 180.);
+
+    if (surface)
+        cairo_set_source_surface(cr, surface, 0, 0);
+    else
+        gdk_cairo_set_source_pixbuf(cr, gImage, 0, 0);
+    /* It's a quarter turn, so every pixel lands on a pixel */
+    cairo_pattern_set_filter(cairo_get_source(cr), CAIRO_FILTER_NEAREST);
+    cairo_paint(cr);
+    cairo_destroy(cr);
+}
+
+/* gImage as it is on the X server, so that drawing it again, for an
+ * expose or while it's dragged, is a copy on the server instead of
+ * converting every pixel and sending it over again. sPixmapImage says
+ * which pixbuf it holds. It's a weak pointer, so it goes to 0 if that
+ * pixbuf goes away, without keeping it alive (which would stop
+ * RotatePixbufInPlace). Anything that changes gImage's pixels in place
+ * has to call ForgetImagePixmap, or go through DrawImageArea.
+ */
+static GdkPixmap* sPixmap = 0;
+static GdkPixbuf* sPixmapImage = 0;
+
+/* Bigger images than this many screens aren't worth the server memory */
+#define PIXMAP_SCREENS 2
+
+void ForgetImagePixmap()
+{
+    ForgetImageSurface();
+    if (sPixmapImage)
+        g_object_remove_weak_pointer(G_OBJECT(sPixmapImage),
+                                     (gpointer*)&sPixmapImage);
+    sPixmapImage = 0;
+    if (sPixmap)
+        g_object_unref(sPixmap);
+    sPixmap = 0;
+}
+
+/* Put gImage on the server if it isn't there already.
+ * Returns the pixmap, or 0 if it's too big to be worth it.
+ */
+static GdkPixmap* ImagePixmap(GdkGC* gc)
+{
+    int width, height;
+
+    if (sPixmap && sPixmapImage == gImage)
+        return sPixmap;
+    ForgetImagePixmap();
+
+    width = gdk_pixbuf_get_width(gImage);
+    height = gdk_pixbuf_get_height(gImage);
+    if ((long)width * height
+        > (long)PIXMAP_SCREENS * gPhysMonitorWidth * gPhysMonitorHeight)
+        return 0;
+
+    sPixmap = gdk_pixmap_new(sDrawingArea->window, width, height, -1);
+    if (!sPixmap)
+        return 0;
+    UploadPixbuf(gImage, sPixmap, gc, 0, 0, 0, 0, width, height);
+    sPixmapImage = gImage;
+    g_object_add_weak_pointer(G_OBJECT(sPixmapImage),
+                              (gpointer*)&sPixmapImage);
+    if (gDebug)
+        printf("Put %dx%d image on the server\n", width, height);
+    return sPixmap;
+}
+
+/* Draw the width x height part of gImage at x, y into drawable,
+ * with the image's upper left corner at dstX, dstY.
+ */
+static void DrawImagePixels(GdkDrawable* drawable, int dstX, int dstY,
+                            int x, int y, int width, int height)
+{
+    GdkGC* gc = sDrawingArea->style->fg_gc[GTK_WIDGET_STATE(sDrawingArea)];
+    GdkPixmap* pixmap = ImagePixmap(gc);
+
+    if (pixmap)
+        gdk_draw_drawable(drawable, gc, pixmap,
+                          x, y, dstX + x, dstY + y, width, height);
+    else
+        UploadPixbuf(gImage, drawable, gc,
+                     x, y, dstX + x, dstY + y, width, height);
+}
+
+/* In presentation mode, PaintArea puts the background and the image
+ * together here and copies the result to the window in one go, so
+ * nothing flashes black between images. It's the size of the window,
+ * and kept for as long as that doesn't change.
+ */
+static GdkPixmap* sPresBuffer = 0;
+
+static void FreePresentationBuffer()
+{
+    if (sPresBuffer)
+        g_object_unref(sPresBuffer);
+    sPresBuffer = 0;
+}
+
+static GdkPixmap* PresentationBuffer()
+{
+    gint width, height, bufWidth, bufHeight;
+
+    gdk_drawable_get_size(sDrawingArea->window, &width, &height);
+    if (sPresBuffer) {
+        gdk_drawable_get_size(sPresBuffer, &bufWidth, &bufHeight);
+        if (bufWidth == width && bufHeight == height)
+            return sPresBuffer;
+        FreePresentationBuffer();
+    }
+
+    sPresBuffer = gdk_pixmap_new(sDrawingArea->window, width, height, -1);
+    if (gDebug)
+        printf("New %dx%d presentation buffer\n", width, height);
+    return sPresBuffer;
+}
+
+/* Presentation mode paints through sPresBuffer, so GTK's double
+ * buffering and X clearing the window to its background first would
+ * only add work, and a black flash. Other modes use GTK's.
+ */
+static void SetPaintingMode()
+{
+    int present = (gDisplayMode == PHO_DISPLAY_PRESENTATION);
+
+    if (sDrawingArea == 0)
+        return;
+    gtk_widget_set_double_buffered(sDrawingArea, !present);
+    if (!sDrawingArea->window)
+        return;
+    if (present)
+        gdk_window_set_back_pixmap(sDrawingArea->window, NULL, FALSE);
     else {
+        gtk_style_set_background(sDrawingArea->style, sDrawingArea->window,
+                                 GTK_STATE_NORMAL);
+        FreePresentationBuffer();
+    }
+}
+
+/* Where PaintArea last put gImage, so dragging can scroll it.
+ * sShownImage is a weak pointer, like sPixmapImage, so a new gImage
+ * that happens to get the same address doesn't look like it's shown.
+ */
+static GdkPixbuf* sShownImage = 0;
+static int sShownX, sShownY, sShownWidth, sShownHeight;
+
+static void SetShownImage(GdkPixbuf* image)
+{
+    if (sShownImage == image)
+        return;
+    if (sShownImage)
+        g_object_remove_weak_pointer(G_OBJECT(sShownImage),
+                                     (gpointer*)&sShownImage);
+    sShownImage = image;
+    if (sShownImage)
+        g_object_add_weak_pointer(G_OBJECT(sShownImage),
+                                  (gpointer*)&sShownImage);
+}
+
+/* Paint the part of the window inside area: whatever part of the
+ * image falls in it, and in presentation mode, black anywhere else.
+ */
+static void PaintArea(GdkRectangle* area)
+{
+    GdkRectangle imageRect, part;
+    GdkDrawable* drawable = sDrawingArea->window;
+    GdkPixmap* buffer = 0;
+    int dstX = 0, dstY = 0;
+
+    GetImageOrigin(&dstX, &dstY);
+    SetShownImage(gImage);
+    sShownX = dstX;
+    sShownY = dstY;
+    sShownWidth = gCurImage->curWidth;
+    sShownHeight = gCurImage->curHeight;
+    imageRect.x = dstX;
+    imageRect.y = dstY;
+    imageRect.width = gCurImage->curWidth;
+    imageRect.height = gCurImage->curHeight;
+
+    /* Clear only the strips around the image, not under it */
+    if (gDisplayMode == PHO_DISPLAY_PRESENTATION) {
+        GdkRectangle strips[4];
+        int i;
+
+        buffer = PresentationBuffer();
+        if (buffer)
+            drawable = buffer;
+
+        strips[0].x = area->x;                   /* above */
+        strips[0].y = area->y;
+        strips[0].width = area->width;
+        strips[0].height = imageRect.y - area->y;
+        strips[1].x = area->x;                   /* below */
+        strips[1].y = imageRect.y + imageRect.height;
+        strips[1].width = area->width;
+        strips[1].height = area->y + area->height - strips[1].y;
+        strips[2].x = area->x;                   /* left */
+        strips[2].y = MAX(area->y, imageRect.y);
+        strips[2].width = imageRect.x - area->x;
+        strips[2].height = MIN(area->y + area->height,
+                               imageRect.y + imageRect.height) - strips[2].y;
+        strips[3].x = imageRect.x + imageRect.width;   /* right */
+        strips[3].y = strips[2].y;
+        strips[3].width = area->x + area->width - strips[3].x;
+        strips[3].height = strips[2].height;
+
+        /* Not gdk_window_clear_area: the window has no background */
+        for (i = 0; i < 4; ++i)
+            if (gdk_rectangle_intersect(&strips[i], area, &part))
+                gdk_draw_rectangle(drawable,
+                                   sDrawingArea->style->bg_gc[GTK_STATE_NORMAL],
+                                   TRUE, part.x, part.y,
+                                   part.width, part.height);
+    }
+
+    if (gdk_rectangle_intersect(&imageRect, area, &part)) {
+        if (TilesActive())
+            DrawTiles(drawable,
+                   sDrawingArea->style->fg_gc[GTK_WIDGET_STATE(sDrawingArea)],
+                      dstX, dstY, part.x, part.y, part.width, part.height);
+        else if (ViewRotation() != 0)
+            DrawRotatedArea(drawable, ViewRotation(), dstX, dstY,
+                            part.x, part.y, part.width, part.height);
+        else
+            DrawImagePixels(drawable, dstX, dstY,
+                            part.x - dstX, part.y - dstY,
+                            part.width, part.height);
+    }
+
+    if (buffer)
+        gdk_draw_drawable(sDrawingArea->window,
+                   sDrawingArea->style->fg_gc[GTK_WIDGET_STATE(sDrawingArea)],
+                          buffer, area->x, area->y, area->x, area->y,
+                          area->width, area->height);
+}
+
+/* Show what gCurImage is in the titlebar and any dialogs.
+ * That doesn't depend on what gets painted, so PrepareWindow calls
+ * this when the image changes, rather than waiting for an expose
+ * that might only cover part of the window.
+ */
+static void UpdateImageInfo()
+{
+    char title[BUFSIZ];
+#   define TITLELEN ((sizeof title) / (sizeof *title))
+
+    if (gCurImage == 0 || gWin == 0 || !sExposed) return;
+    if (!GTK_WIDGET_MAPPED(gWin)) return;
+
+    if (gDisplayMode != PHO_DISPLAY_PRESENTATION) {
         /* Update the titlebar */
-        sprintf(title, "pho: %s (%d x %d)", gCurImage->filename,
+        sprintf(title, "pho: %s [%d/%d] (%d x %d)", gCurImage->filename,
+                ImageIndex(gCurImage) + 1, CountImages(),
                 gCurImage->trueWidth, gCurImage->trueHeight);
-        if (HasExif())
+        if (gCurImage->exifDate)
         {
-            const char* date = ExifGetString(ExifDate);
-            if (date && date[0]) {
-                /* Make sure there's room */
-                if (strlen(title) + strlen(date) + 3 < TITLELEN)
-                    strcat(title, " (");
-                strcat(title, date);
-                strcat(title, ")");
-            }
+            const char* date = gCurImage->exifDate;
+            /* Make sure there's room */
+            if (strlen(title) + strlen(date) + 3 < TITLELEN)
+                strcat(title, " (");
+            strcat(title, date);
+            strcat(title, ")");
         }
         /* XXX replace these strcats with safer strncat */
         if (gScaleMode == PHO_SCALE_FULLSIZE)
@@ -409,18 +788,153 @@ void DrawImage()
 
         if (gDisplayMode == PHO_DISPLAY_KEYWORDS) {
             if (gDebug)
-                printf("Showing keywords dialog from DrawImage\n");
+                printf("Showing keywords dialog from UpdateImageInfo\n");
             ShowKeywordsDialog(gCurImage);
         }
     }
 
-    gdk_pixbuf_render_to_drawable(gImage, sDrawingArea->window,
+    UpdateInfoDialog(gCurImage);
+}
+
+/* DrawImage is called from the expose callback:
+ * anyone else who wants the image redrawn should call ScheduleDraw.
+ * It assumes we already have the image in gImage.
+ */
+void DrawImage()
+{
+    GdkRectangle area;
+
+    if (gDebug) {
+        printf("DrawImage %s, %dx%d\n", gCurImage->filename,
+               gCurImage->curWidth, gCurImage->curHeight);
+    }
+
+    if (gImage == 0 || gWin == 0 || sDrawingArea == 0) return;
+    if (!sExposed) return;
+    if (!GTK_WIDGET_MAPPED(gWin)) return;
+
+    area.x = area.y = 0;
+    gdk_drawable_get_size(sDrawingArea->window, &area.width, &area.height);
+    PaintArea(&area);
+
+    sDrawPending = 0;
+    sLastFrame = g_get_monotonic_time();
+    ++sDrawsDone;
+    if (gDebug)
+        printf("Painted %d times for %d redraw requests\n",
+               sDrawsDone, sDrawsRequested);
+}
+
+/* Redraw the whole window, if anyone still wants that,
+ * by invalidating it and letting the expose handler paint it,
+ * so it's double-buffered like any other expose.
+ */
+static gboolean DrawFrame(gpointer data)
+{
+    sDrawSource = 0;
+    if (!sDrawPending)
+        return FALSE;
+
+    /* Not showing yet: the first expose will draw everything */
+    if (gWin == 0 || sDrawingArea == 0 || !sExposed
+        || !GTK_WIDGET_MAPPED(gWin)) {
+        sDrawPending = 0;
+        return FALSE;
+    }
+
+    sInFrame = 1;
+    gdk_window_invalidate_rect(sDrawingArea->window, 0, FALSE);
+    gdk_window_process_updates(sDrawingArea->window, FALSE);
+    sInFrame = 0;
+    return FALSE;
+}
+
+/* Ask for the image to be redrawn. Requests are collected until
+ * the next frame, no sooner than FRAME_USEC after the last paint.
+ */
+void ScheduleDraw()
+{
+    gint64 wait;
+
+    ++sDrawsRequested;
+    sDrawPending = 1;
+    if (sDrawSource)
+        return;
+
+    wait = sLastFrame + FRAME_USEC - g_get_monotonic_time();
+    if (wait <= 0)
+        sDrawSource = g_idle_add_full(GDK_PRIORITY_REDRAW, DrawFrame, 0, 0);
+    else
+        sDrawSource = g_timeout_add_full(GDK_PRIORITY_REDRAW,
+                                         (guint)((wait + 999) / 1000),
+                                         DrawFrame, 0, 0);
+}
+
+/* Draw just one rectangle of gImage, e.g. the part of an image
+ * that has finished loading, and update the server's copy of it.
+ * Doesn't touch the titlebar or dialogs.
+ */
+void DrawImageArea(int x, int y, int width, int height)
+{
+    int dstX, dstY;
+
+    if (gImage == 0 || gWin == 0 || sDrawingArea == 0) return;
+
+    /* Those pixels probably changed, even if they can't be seen now */
+    if (sSurface && sSurfaceImage == gImage)
+        UpdateImageSurface(x, y, width, height);
+    if (sPixmap && sPixmapImage == gImage)
+        UploadPixbuf(gImage, sPixmap,
                    sDrawingArea->style->fg_gc[GTK_WIDGET_STATE(sDrawingArea)],
-                                  0, 0, dstX, dstY,
-                                  gCurImage->curWidth, gCurImage->curHeight,
-                                  GDK_RGB_DITHER_NONE, 0, 0);
+                     x, y, x, y, width, height);
 
-    UpdateInfoDialog(gCurImage);
+    if (!sExposed) return;
+    if (!GTK_WIDGET_MAPPED(gWin)) return;
+
+    GetImageOrigin(&dstX, &dstY);
+    if (TilesActive())
+        DrawTiles(sDrawingArea->window,
+                  sDrawingArea->style->fg_gc[GTK_WIDGET_STATE(sDrawingArea)],
+                  dstX, dstY, dstX + x, dstY + y, width, height);
+    else if (ViewRotation() != 0)
+        DrawRotatedArea(sDrawingArea->window, ViewRotation(), dstX, dstY,
+                        dstX + x, dstY + y, width, height);
+    else
+        DrawImagePixels(sDrawingArea->window, dstX, dstY,
+                        x, y, width, height);
+}
+
+/* The drag offset changed: move the pixels already in the window
+ * and let the expose handler paint just the strips scrolled in,
+ * rather than painting the whole window again.
+ */
+static void ScrollImage()
+{
+    int dstX, dstY;
+    gint width, height;
+
+    /* Only if what's in the window is gImage, where PaintArea put it */
+    if (sDrawPending || !sExposed || gImage == 0 || gImage != sShownImage
+        || gCurImage->curWidth != sShownWidth
+        || gCurImage->curHeight != sShownHeight
+        || !GTK_WIDGET_MAPPED(gWin)) {
+        ScheduleDraw();
+        return;
+    }
+
+    GetImageOrigin(&dstX, &dstY);
+    if (dstX == sShownX && dstY == sShownY)
+        return;
+
+    gdk_drawable_get_size(sDrawingArea->window, &width, &height);
+    if (ABS(dstX - sShownX) >= width || ABS(dstY - sShownY) >= height) {
+        ScheduleDraw();
+        return;
+    }
+
+    gdk_window_scroll(sDrawingArea->window, dstX - sShownX, dstY - sShownY);
+    sShownX = dstX;
+    sShownY = dstY;
 }
 
 static gboolean
@@ -429,6 +943,10 @@ HandlePress(GtkWidget *widget, GdkEventButton *event)
     if (event->button != 2 )
         return TRUE;
 
+    /* Outside presentation mode, only tiled images can be dragged */
+    if (gDisplayMode != PHO_DISPLAY_PRESENTATION && !TilesActive())
+        return TRUE;
+
     /*  grab with owner_events == TRUE so the popup's widgets can
      *  receive events. we filter away events outside this toplevel
      *  away in button_press()
@@ -463,6 +981,11 @@ HandleMotionNotify(GtkWidget *widget, GdkEventMotion *event)
 #define DRAGRESTART 3
     int x, y;
     GdkModifierType state;
+
+    /* The grab asks for motion hints, so there's only ever one motion
+     * event waiting, however fast the mouse moves. Ask for the next.
+     */
+    gdk_event_request_motions(event);
     gdk_window_get_pointer (widget->window, &x, &y, &state);
 
     if (state & GDK_BUTTON2_MASK) {
@@ -513,8 +1036,7 @@ HandleMotionNotify(GtkWidget *widget, GdkEventMotion *event)
             }
         }
 
-        /* This flickers: would be nice to collapse events more */
-        DrawImage();
+        ScrollImage();
     }
 
     return TRUE;
@@ -527,6 +1049,7 @@ HandleMotionNotify(GtkWidget *widget, GdkEventMotion *event)
 static gint HandleExpose(GtkWidget* widget, GdkEventExpose* event)
 {
     gint width, height;
+    int firstExpose = !sExposed;
 
     sExposed = 1;
     gdk_drawable_get_size(widget->window, &width, &height);
@@ -571,8 +1094,9 @@ static gint HandleExpose(GtkWidget* widget, GdkEventExpose* event)
         int oldh = sFrameHeight;
         AdjustScreenSize();
         if (sFrameWidth != oldw || sFrameHeight != oldh) {
-            gtk_window_resize(GTK_WINDOW(gWin),
-                              gCurImage->curWidth, gCurImage->curHeight);
+            gint winwidth, winheight;
+            GetWindowSize(&winwidth, &winheight);
+            gtk_window_resize(GTK_WINDOW(gWin), winwidth, winheight);
             /* Since we resized, we might no longer be over the cursor
              * and may have lost focus:
              */
@@ -580,7 +1104,26 @@ static gint HandleExpose(GtkWidget* widget, GdkEventExpose* event)
         }
     }
 
-    DrawImage();
+    /* The first time, the titlebar and dialogs have to be set up too. */
+    if (firstExpose)
+        UpdateImageInfo();
+
+    /* Repaint everything the first time, and when DrawFrame is doing
+     * a scheduled redraw. Otherwise, only repaint what was actually
+     * uncovered, e.g. where a dialog was moved off the image.
+     */
+    if (firstExpose || sInFrame
+        || !gImage || !gCurImage || !GTK_WIDGET_MAPPED(gWin))
+        DrawImage();
+    else {
+        GdkRectangle* rects;
+        gint nrects, i;
+
+        gdk_region_get_rectangles(event->region, &rects, &nrects);
+        for (i = 0; i < nrects; ++i)
+            PaintArea(&rects[i]);
+        g_free(rects);
+    }
 
     return TRUE;
 }
@@ -690,22 +1233,25 @@ static void NewWindow()
         gtk_drawing_area_size(GTK_DRAWING_AREA(sDrawingArea),
                               gPhysMonitorWidth, gPhysMonitorHeight);
         gtk_window_fullscreen(GTK_WINDOW(gWin));
-
-        /* Listen for middle clicks to drag position: */
-        gtk_widget_set_events(sDrawingArea, GDK_BUTTON_PRESS_MASK);
-        gtk_signal_connect(GTK_OBJECT(sDrawingArea), "button_press_event",
-                           (GtkSignalFunc)HandlePress, 0);
-        gtk_signal_connect(GTK_OBJECT(sDrawingArea), "button_release_event",
-                           (GtkSignalFunc)HandleRelease, 0);
-        gtk_signal_connect(GTK_OBJECT(sDrawingArea), "motion_notify_event",
-                           (GtkSignalFunc)HandleMotionNotify, 0);
     }
     else {
-        gtk_drawing_area_size(GTK_DRAWING_AREA(sDrawingArea),
-                              gCurImage->curWidth, gCurImage->curHeight);
+        gint width, height;
+        GetWindowSize(&width, &height);
+        gtk_drawing_area_size(GTK_DRAWING_AREA(sDrawingArea), width, height);
         gtk_window_unfullscreen(GTK_WINDOW(gWin));
     }
 
+    /* Listen for middle clicks to drag position.
+     * HandlePress decides whether there's anything to drag.
+     */
+    gtk_widget_set_events(sDrawingArea, GDK_BUTTON_PRESS_MASK);
+    gtk_signal_connect(GTK_OBJECT(sDrawingArea), "button_press_event",
+                       (GtkSignalFunc)HandlePress, 0);
+    gtk_signal_connect(GTK_OBJECT(sDrawingArea), "button_release_event",
+                       (GtkSignalFunc)HandleRelease, 0);
+    gtk_signal_connect(GTK_OBJECT(sDrawingArea), "motion_notify_event",
+                       (GtkSignalFunc)HandleMotionNotify, 0);
+
     gtk_signal_connect(GTK_OBJECT(sDrawingArea), "expose_event",
                        (GtkSignalFunc)HandleExpose, 0);
     /* To track in/out of fullscreen mode, use configure_event
@@ -717,6 +1263,7 @@ static void NewWindow()
     /* Must come after show(), hide_cursor needs a window */
     if (gDisplayMode == PHO_DISPLAY_PRESENTATION)
         hide_cursor(sDrawingArea);
+    SetPaintingMode();
 
     /* Hopefully gWin->window exists by now, so it's safe
      * to place it on the intended monitor.
@@ -769,8 +1316,9 @@ void PrepareWindow()
                               gPhysMonitorWidth, gPhysMonitorHeight);
     }
     else {
-        gint winwidth, winheight;
+        gint winwidth, winheight, width, height;
 
+        GetWindowSize(&width, &height);
         gdk_drawable_get_size(gWin->window, &winwidth, &winheight);
         gdk_drawable_get_size(sDrawingArea->window, &winwidth, &winheight);
 
@@ -794,10 +1342,8 @@ void PrepareWindow()
          * Likewise, if the next line doesn't actually resize anything
          * we may not get an expose event.
          */
-        if (gCurImage->curWidth != winwidth
-            || gCurImage->curHeight != winheight) {
-            gtk_window_resize(GTK_WINDOW(gWin),
-                              gCurImage->curWidth, gCurImage->curHeight);
+        if (width != winwidth || height != winheight) {
+            gtk_window_resize(GTK_WINDOW(gWin), width, height);
 
             /* Unfortunately, on OS X this resize may not work,
              * if it puts part ofthe window off-screen; in which case
@@ -808,28 +1354,27 @@ void PrepareWindow()
              * on Linux either, until after the window manager has had
              * a chance to act on the resize request
              * (at which time we'll get another Configure notify).
-             * So the dilemma is: we need to call DrawImage now in the
+             * So the dilemma is: we need to redraw now in the
              * case where there will be no further events. But if there
              * are further events, we want to wait for them and not
              */
             gdk_drawable_get_size(sDrawingArea->window, &winwidth, &winheight);
-            if (gCurImage->curWidth != winwidth
-                || gCurImage->curHeight != winheight) {
+            if (width != winwidth || height != winheight) {
                 if (gDebug)
                     printf("Resize didn't work! Forcing redraw\n");
-                DrawImage();
+                ScheduleDraw();
             }
         }
 
         /* If we didn't resize the window, then we won't get an expose
-         * event, and hence DrawImage won't be called. So call it explicitly
+         * event, and hence DrawImage won't be called. So ask for a redraw
          * -- but not if we haven't displayed a window yet.
          * If we do that, we get duplicate calls to DrawImage
          * plus in keywords mode, the keywords dialog gets set as
          * transient too early. (I hate window management.)
          */
         else if (GTK_WIDGET_VISIBLE(gWin)) {
-            DrawImage();
+            ScheduleDraw();
         }
 
         /* Try to ensure that the window will be over the cursor
@@ -841,6 +1386,11 @@ void PrepareWindow()
         MaybeMove();
     }
 
+    /* Whatever gets exposed, the titlebar and dialogs should
+     * match the new image.
+     */
+    UpdateImageInfo();
+
     /* Want to request the focus here, but
      * neither gtk_window_present nor gdk_window_focus seem to work.
      */
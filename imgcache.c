@@ -0,0 +1,314 @@
+/* -*- Mode: C; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+/*
+ * imgcache.c: a memory-limited cache of display-ready pixbufs,
+ * so going back and forth between images doesn't mean decoding
+ * them over and over.
+ *
+ * Copyright 2026 by Akkana Peck.
+ * You are free to use or modify this code under the Gnu Public License.
+ */
+
+/* Entries are kept in a doubly linked list in order of use,
+ * most recently used first; when the cache is over its budget,
+ * entries come off the end of the list.
+ *
+ * An entry is keyed by the PhoImage, its rotation, and its size:
+ * a lookup only matches if ScaleAndRotate wouldn't have to change
+ * the pixbuf's size under the current scale parameters.
+ *
+ * Masters are full-resolution, unrotated copies of images, kept
+ * (with -M) so that zooming in doesn't mean reading the file again.
+ * They share the list and the budget with everything else, but
+ * ordinary lookups never match them.
+ *
+ * The cache holds its own reference to each pixbuf, so the pixbufs
+ * must not be changed in place.
+ *
+ * An entry's size includes any mip levels scale.c has hung off its
+ * pixbuf. Those only get made on the main thread, by scaling a pixbuf
+ * that's in the cache, and the result is then cached too; so sizes
+ * are brought up to date whenever something is added.
+ */
+
+#include "pho.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+
+typedef struct CacheEntry_s {
+    PhoImage* img;
+    GdkPixbuf* pixbuf;
+    int rot;                      /* rotation of the pixbuf */
+    int trueWidth, trueHeight;    /* full image size at that rotation */
+    int master;                   /* full-resolution master copy */
+    unsigned long bytes;
+    struct CacheEntry_s* prev;
+    struct CacheEntry_s* next;
+} CacheEntry;
+
+/* Memory budget, in megabytes. 0 turns off caching and prefetching. */
+int gCacheMegabytes = 256;
+
+/* Keep full-resolution masters as well as display-sized images */
+int gKeepMasters = 0;
+
+static CacheEntry* sMostRecent = 0;
+static CacheEntry* sLeastRecent = 0;
+static unsigned long sCacheBytes = 0;
+static int sNumEntries = 0;
+
+/* Statistics, for debugging */
+static int sHits = 0;
+static int sMisses = 0;
+static int sEvictions = 0;
+
+#define CACHE_BUDGET ((unsigned long)gCacheMegabytes * 1024 * 1024)
+
+static void PrintCacheStats()
+{
+    printf("Cache: %d hits, %d misses, %d evictions; "
+           "%lu of %lu bytes in %d entries\n",
+           sHits, sMisses, sEvictions,
+           sCacheBytes, CACHE_BUDGET, sNumEntries);
+}
+
+static void UnlinkEntry(CacheEntry* entry)
+{
+    if (entry->prev)
+        entry->prev->next = entry->next;
+    else
+        sMostRecent = entry->next;
+    if (entry->next)
+        entry->next->prev = entry->prev;
+    else
+        sLeastRecent = entry->prev;
+    entry->prev = entry->next = 0;
+}
+
+static void LinkAtFront(CacheEntry* entry)
+{
+    entry->prev = 0;
+    entry->next = sMostRecent;
+    if (sMostRecent)
+        sMostRecent->prev = entry;
+    sMostRecent = entry;
+    if (!sLeastRecent)
+        sLeastRecent = entry;
+}
+
+static void RemoveEntry(CacheEntry* entry)
+{
+    UnlinkEntry(entry);
+    sCacheBytes -= entry->bytes;
+    --sNumEntries;
+    g_object_unref(entry->pixbuf);
+    free(entry);
+}
+
+static unsigned long PixbufBytes(GdkPixbuf* pixbuf)
+{
+    return (unsigned long)gdk_pixbuf_get_rowstride(pixbuf)
+        * gdk_pixbuf_get_height(pixbuf) + MipBytes(pixbuf);
+}
+
+/* Count any mip levels made since the entries were added */
+static void RecountEntries()
+{
+    CacheEntry* entry;
+
+    sCacheBytes = 0;
+    for (entry = sMostRecent; entry; entry = entry->next) {
+        entry->bytes = PixbufBytes(entry->pixbuf);
+        sCacheBytes += entry->bytes;
+    }
+}
+
+/* Would ScaleAndRotate(img, 0) leave this entry's pixbuf alone? */
+static int EntryFits(CacheEntry* entry, PhoScaleParams* params)
+{
+    int width = gdk_pixbuf_get_width(entry->pixbuf);
+    int height = gdk_pixbuf_get_height(entry->pixbuf);
+    int new_width, new_height;
+
+    CalcScaledSize(params, entry->trueWidth, entry->trueHeight,
+                   width, height, 0, &new_width, &new_height);
+    return (new_width == width && new_height == height);
+}
+
+static CacheEntry* FindEntry(PhoImage* img, int rot, PhoScaleParams* params)
+{
+    CacheEntry* entry;
+    for (entry = sMostRecent; entry; entry = entry->next)
+        if (entry->img == img && !entry->master
+            && (rot < 0 || entry->rot == rot)
+            && EntryFits(entry, params))
+            return entry;
+    return 0;
+}
+
+/* Stay within budget, but never throw out keep */
+static void TrimCache(CacheEntry* keep)
+{
+    while (sCacheBytes > CACHE_BUDGET && sLeastRecent != keep) {
+        if (gDebug)
+            printf("Evicting %s (%dx%d) from cache\n",
+                   sLeastRecent->img->filename,
+                   gdk_pixbuf_get_width(sLeastRecent->pixbuf),
+                   gdk_pixbuf_get_height(sLeastRecent->pixbuf));
+        RemoveEntry(sLeastRecent);
+        ++sEvictions;
+    }
+}
+
+static void AddEntry(PhoImage* img, GdkPixbuf* pixbuf, int rot,
+                     int trueWidth, int trueHeight, int master)
+{
+    CacheEntry* entry;
+    CacheEntry* next;
+    unsigned long bytes;
+
+    if (!img || !pixbuf || gCacheMegabytes <= 0)
+        return;
+
+    bytes = PixbufBytes(pixbuf);
+    if (bytes > CACHE_BUDGET) {
+        if (gDebug)
+            printf("Not caching %s: %lu bytes is too big\n",
+                   img->filename, bytes);
+        return;
+    }
+
+    RecountEntries();
+
+    /* Replace anything else we have for this image at this rotation
+     * and size; if it's the very same pixbuf, just mark it as used.
+     */
+    for (entry = sMostRecent; entry; entry = next) {
+        next = entry->next;
+        if (entry->img != img || entry->rot != rot
+            || entry->master != master)
+            continue;
+        if (entry->pixbuf == pixbuf) {
+            UnlinkEntry(entry);
+            LinkAtFront(entry);
+            TrimCache(entry);
+            return;
+        }
+        if (gdk_pixbuf_get_width(entry->pixbuf)
+                == gdk_pixbuf_get_width(pixbuf)
+            && gdk_pixbuf_get_height(entry->pixbuf)
+                == gdk_pixbuf_get_height(pixbuf))
+            RemoveEntry(entry);
+    }
+
+    entry = calloc(1, sizeof (CacheEntry));
+    if (!entry)
+        return;
+    entry->img = img;
+    entry->pixbuf = g_object_ref(pixbuf);
+    entry->rot = rot;
+    entry->trueWidth = trueWidth;
+    entry->trueHeight = trueHeight;
+    entry->master = master;
+    entry->bytes = bytes;
+    LinkAtFront(entry);
+    sCacheBytes += bytes;
+    ++sNumEntries;
+
+    TrimCache(entry);
+
+    if (gDebug) {
+        printf("Cached %s%s (%dx%d, rotation %d)\n", img->filename,
+               master ? " master" : "",
+               gdk_pixbuf_get_width(pixbuf), gdk_pixbuf_get_height(pixbuf),
+               rot);
+        PrintCacheStats();
+    }
+}
+
+void CacheAdd(PhoImage* img, GdkPixbuf* pixbuf, int rot,
+              int trueWidth, int trueHeight)
+{
+    AddEntry(img, pixbuf, rot, trueWidth, trueHeight, 0);
+}
+
+void CacheAddMaster(PhoImage* img, GdkPixbuf* pixbuf)
+{
+    if (!gKeepMasters || !pixbuf)
+        return;
+    AddEntry(img, pixbuf, 0, gdk_pixbuf_get_width(pixbuf),
+             gdk_pixbuf_get_height(pixbuf), 1);
+}
+
+static CacheEntry* FindMaster(PhoImage* img)
+{
+    CacheEntry* entry;
+    for (entry = sMostRecent; entry; entry = entry->next)
+        if (entry->img == img && entry->master)
+            return entry;
+    return 0;
+}
+
+GdkPixbuf* CacheLookupMaster(PhoImage* img)
+{
+    CacheEntry* entry = FindMaster(img);
+
+    if (!entry) {
+        if (gDebug)
+            printf("No master for %s\n", img->filename);
+        return 0;
+    }
+
+    UnlinkEntry(entry);
+    LinkAtFront(entry);
+    if (gDebug)
+        printf("Using master for %s\n", img->filename);
+    return g_object_ref(entry->pixbuf);
+}
+
+int CacheHasMaster(PhoImage* img)
+{
+    return FindMaster(img) != 0;
+}
+
+GdkPixbuf* CacheLookup(PhoImage* img, int rot, PhoScaleParams* params,
+                       int* trueWidth, int* trueHeight)
+{
+    CacheEntry* entry = FindEntry(img, rot, params);
+
+    if (!entry) {
+        ++sMisses;
+        if (gDebug) {
+            printf("Cache miss for %s\n", img->filename);
+            PrintCacheStats();
+        }
+        return 0;
+    }
+
+    ++sHits;
+    UnlinkEntry(entry);
+    LinkAtFront(entry);
+    *trueWidth = entry->trueWidth;
+    *trueHeight = entry->trueHeight;
+    if (gDebug) {
+        printf("Cache hit for %s\n", img->filename);
+        PrintCacheStats();
+    }
+    return g_object_ref(entry->pixbuf);
+}
+
+int CacheHas(PhoImage* img, int rot, PhoScaleParams* params)
+{
+    return FindEntry(img, rot, params) != 0;
+}
+
+void CacheForget(PhoImage* img)
+{
+    CacheEntry* entry;
+    CacheEntry* next;
+    for (entry = sMostRecent; entry; entry = next) {
+        next = entry->next;
+        if (entry->img == img)
+            RemoveEntry(entry);
+    }
+}
@@ -46,7 +46,19 @@ int gPendingTimeout = 0;
 /* Loop back to the first image after showing the last one */
 int gRepeat = 0;
 
+/* Show the EXIF thumbnail while the real image is loading */
+int gThumbPreview = 0;
+
 static int RotateImage(PhoImage* img, int degrees);    /* forward */
+static void RotateAtDrawTime(PhoImage* img, int degrees);
+static void ClearViewRotation();
+static int QuickScaleShowing();
+static void RememberQuickScale(GdkPixbuf* source, int degrees);
+static int QuickScaleStillRight(PhoImage* img);
+static int UndoQuickScale(PhoImage* img);
+
+/* Scaling from more pixels than this gets a quick scale first */
+#define QUICK_SCALE_PIXELS (4L * 1024 * 1024)
 
 static gint DelayTimer(gpointer data)
 {
@@ -63,7 +75,10 @@ static gint DelayTimer(gpointer data)
 int ShowImage()
 {
     ScaleAndRotate(gCurImage, 0);
-    /* Keywords dialog will be updated if necessary from DrawImage */
+    /* PrepareWindow updates the titlebar and dialogs to match */
+
+    /* While the user looks at this one, get the next and previous ready */
+    PrefetchNeighbors();
 
     if (gDelayMillis > 0 && gPendingTimeout == 0
         && (gCurImage->next != 0 || gCurImage->next != gFirstImage)) {
@@ -74,10 +89,175 @@ int ShowImage()
     return 0;
 }
 
-static int LoadImageFromFile(PhoImage* img)
+/* Read the EXIF info for img the first time it's needed, and keep
+ * the parts pho uses, so showing it again (e.g. from the cache)
+ * doesn't mean opening and parsing the file again.
+ */
+static void ReadExifRotation(PhoImage* img)
 {
-    GError* err = NULL;
     int rot;
+    const char* date;
+
+    if (img->exifRead)
+        return;
+
+    ExifReadInfo(img->filename);
+    if (HasExif() && (rot = ExifGetInt(ExifOrientation)) != 0)
+        img->exifRot = rot;
+    else
+        img->exifRot = 0;
+    img->exifMirror = ExifIsMirrored();
+    date = (HasExif() ? ExifGetString(ExifDate) : 0);
+    img->exifDate = (date && date[0] ? strdup(date) : 0);
+    img->exifRead = 1;
+}
+
+/* Decoding at reduced size: libjpeg can scale by 1/2, 1/4 or 1/8
+ * as it decodes, which is much faster (and uses much less memory)
+ * than decoding the whole image and then throwing most of it away.
+ * gdk-pixbuf's jpeg loader does that when asked for a smaller size
+ * from its size-prepared signal; asking for exactly the size libjpeg
+ * will produce keeps gdk-pixbuf from doing any scaling of its own.
+ */
+#define MAX_DECODE_DENOM 8
+
+typedef struct {
+    PhoScaleParams* params;   /* 0 means decode at full size */
+    int rot;                  /* display rotation, -1 if unknown */
+    int trueWidth, trueHeight;
+} DecodeSizeInfo;
+
+static void DecodeSizePrepared(GdkPixbufLoader* loader,
+                               gint width, gint height, gpointer data)
+{
+    DecodeSizeInfo* info = (DecodeSizeInfo*)data;
+    GdkPixbufFormat* format;
+    gchar* formatName;
+    int isJpeg;
+    int target_w, target_h, denom;
+
+    info->trueWidth = width;
+    info->trueHeight = height;
+
+    /* Only the modes that fit the image to the screen
+     * ever want less than full resolution.
+     */
+    if (!info->params
+        || (info->params->scaleMode != PHO_SCALE_NORMAL
+            && info->params->scaleMode != PHO_SCALE_SCREEN_RATIO
+            && info->params->scaleMode != PHO_SCALE_FIXED))
+        return;
+
+    /* Other formats would decode at full size and then scale,
+     * and we can do that better ourselves.
+     */
+    format = gdk_pixbuf_loader_get_format(loader);
+    formatName = (format ? gdk_pixbuf_format_get_name(format) : 0);
+    isJpeg = (formatName && !strcmp(formatName, "jpeg"));
+    g_free(formatName);
+    if (!isJpeg)
+        return;
+
+    if (info->rot >= 0)
+        CalcScaledSize(info->params, width, height, width, height,
+                       info->rot, &target_w, &target_h);
+    else {
+        /* Don't know the rotation yet: make it big enough either way */
+        int w90, h90;
+        CalcScaledSize(info->params, width, height, width, height,
+                       0, &target_w, &target_h);
+        CalcScaledSize(info->params, width, height, width, height,
+                       90, &w90, &h90);
+        if (w90 > target_w) target_w = w90;
+        if (h90 > target_h) target_h = h90;
+    }
+
+    for (denom = MAX_DECODE_DENOM; denom > 1; denom /= 2) {
+        int w = (width + denom - 1) / denom;
+        int h = (height + denom - 1) / denom;
+        if (w >= target_w && h >= target_h) {
+            if (gDebug)
+                printf("Decoding %dx%d at 1/%d: %dx%d for %dx%d\n",
+                       width, height, denom, w, h, target_w, target_h);
+            gdk_pixbuf_loader_set_size(loader, w, h);
+            return;
+        }
+    }
+}
+
+/* Read filename into a new pixbuf. If params is set, JPEGs are decoded
+ * at the smallest reduced size that's still at least as big as the
+ * size they'd be shown at, rotated by rot (-1 if not known).
+ * *trueWidth and *trueHeight get the full size of the image.
+ * This doesn't touch any globals, so it's safe from any thread.
+ */
+GdkPixbuf* LoadPixbufForDisplay(const char* filename, PhoScaleParams* params,
+                                int rot, int* trueWidth, int* trueHeight,
+                                GError** err)
+{
+    DecodeSizeInfo info;
+    GdkPixbufLoader* loader;
+    GdkPixbuf* pix = 0;
+    guchar buf[65536];
+    size_t len;
+    int ok = 1;
+    FILE* fp = fopen(filename, "rb");
+
+    if (!fp) {
+        int saveErrno = errno;
+        g_set_error(err, G_FILE_ERROR, g_file_error_from_errno(saveErrno),
+                    "%s", g_strerror(saveErrno));
+        return 0;
+    }
+
+    info.params = params;
+    info.rot = rot;
+    info.trueWidth = info.trueHeight = 0;
+
+    loader = gdk_pixbuf_loader_new();
+    g_signal_connect(G_OBJECT(loader), "size-prepared",
+                     G_CALLBACK(DecodeSizePrepared), &info);
+
+    while (ok && (len = fread(buf, 1, sizeof buf, fp)) > 0)
+        ok = gdk_pixbuf_loader_write(loader, buf, len, err);
+    fclose(fp);
+
+    /* close has to be called even after an error, but mustn't
+     * overwrite the error we already have.
+     */
+    if (!gdk_pixbuf_loader_close(loader, ok ? err : 0))
+        ok = 0;
+
+    if (ok && (pix = gdk_pixbuf_loader_get_pixbuf(loader)) != 0)
+        g_object_ref(pix);
+    g_object_unref(loader);
+
+    if (!pix) {
+        if (err && !*err)
+            g_set_error(err, GDK_PIXBUF_ERROR, GDK_PIXBUF_ERROR_FAILED,
+                        "Couldn't load image");
+        return 0;
+    }
+
+    /* Decoders rotate nothing and flip nothing: the first
+     * RotatePixbuf or ScaleRotatePixbuf has to do the flip.
+     */
+    MarkIfMirrored(pix);
+
+    *trueWidth = info.trueWidth;
+    *trueHeight = info.trueHeight;
+    return pix;
+}
+
+/* Load img into gImage. rot is the rotation (from curRot 0)
+ * it's going to be shown at, which affects how small it can
+ * be decoded.
+ */
+static int LoadImageFromFile(PhoImage* img, int rot)
+{
+    GError* err = NULL;
+    PhoScaleParams params;
+    int trueWidth, trueHeight;
 
     if (img == 0)
         return -1;
@@ -91,11 +271,14 @@ static int LoadImageFromFile(PhoImage* img)
         gImage = 0;
     }
 
-    gImage = gdk_pixbuf_new_from_file(img->filename, &err);
+    GetScaleParams(&params);
+    gImage = LoadPixbufForDisplay(img->filename, &params, rot,
+                                  &trueWidth, &trueHeight, &err);
     if (!gImage)
     {
         gImage = 0;
         fprintf(stderr, "Can't open %s: %s\n", img->filename, err->message);
+        g_error_free(err);
         return -1;
     }
     ReadCaption(img);
@@ -107,47 +290,591 @@ static int LoadImageFromFile(PhoImage* img)
      * to its appropriate EXIF rotation. Subsequently, though,
      * it should be rotated to curRot.
      */
-    if (img->trueWidth == 0 || img->trueHeight == 0) {
-        /* Read the EXIF rotation if we haven't already rotated this image */
-        ExifReadInfo(img->filename);
-        if (HasExif() && (rot = ExifGetInt(ExifOrientation)) != 0)
-            img->exifRot = rot;
-        else
-            img->exifRot = 0;
-    }
+    if (img->trueWidth == 0 || img->trueHeight == 0)
+        ReadExifRotation(img);
 
     /* trueWidth and Height used to be set inside EXIF clause,
      * but that doesn't make sense -- we need it not just the first
      * time, but also ever time the image is reloaded.
+     * They're the size of the whole image, even if we decoded less.
      */
-    img->trueWidth = img->curWidth;
-    img->trueHeight = img->curHeight;
+    img->trueWidth = trueWidth;
+    img->trueHeight = trueHeight;
+
+    /* If we had to decode all of it anyway, hang on to it */
+    if (img->curWidth == trueWidth && img->curHeight == trueHeight)
+        CacheAddMaster(img, gImage);
 
     return 0;
 }
 
-static int LoadImageAndRotate(PhoImage* img)
+/* Get img back into gImage at full resolution and no rotation,
+ * for when it needs to get bigger: from its master if we kept one,
+ * else from the file. rot is the rotation it'll be shown at.
+ */
+static int ReloadImage(PhoImage* img, int rot)
+{
+    GdkPixbuf* master;
+
+    if (gKeepMasters) {
+        PrefetchWaitMaster(img);
+        master = CacheLookupMaster(img);
+        if (master) {
+            if (gImage)
+                g_object_unref(gImage);
+            gImage = master;
+            img->curWidth = img->trueWidth = gdk_pixbuf_get_width(gImage);
+            img->curHeight = img->trueHeight = gdk_pixbuf_get_height(gImage);
+            img->curRot = 0;
+            return 0;
+        }
+    }
+
+    return LoadImageFromFile(img, rot);
+}
+
+/* Use a cached copy of img if there's one that's already scaled
+ * and rotated the way we'd do it here.
+ * Returns 0 on success, -1 if there's nothing suitable.
+ */
+static int LoadCachedImage(PhoImage* img, int firsttime)
+{
+    PhoScaleParams params;
+    int trueWidth, trueHeight, rot;
+    GdkPixbuf* pix;
+
+    /* If the prefetcher is working on it, let it finish */
+    PrefetchWait(img);
+
+    /* The first time, show it at its EXIF rotation;
+     * after that, however the user left it.
+     */
+    ReadExifRotation(img);
+    rot = (firsttime ? img->exifRot : img->curRot);
+
+    GetScaleParams(&params);
+    pix = CacheLookup(img, rot, &params, &trueWidth, &trueHeight);
+    if (!pix)
+        return -1;
+
+    if (gImage)
+        g_object_unref(gImage);
+    gImage = pix;
+    ReadCaption(img);
+
+    img->curWidth = gdk_pixbuf_get_width(gImage);
+    img->curHeight = gdk_pixbuf_get_height(gImage);
+    img->trueWidth = trueWidth;
+    img->trueHeight = trueHeight;
+    img->curRot = rot;
+    return 0;
+}
+
+/* Put up a quick preview of img, made from its EXIF thumbnail
+ * scaled up to the size the real image will be shown at, so there's
+ * something to look at while the real image decodes.
+ */
+static int ShowThumbnailPreview(PhoImage* img, int rot)
+{
+    const unsigned char* thumbData;
+    unsigned int thumbSize;
+    int width, height, new_width, new_height;
+    PhoScaleParams params;
+    GdkPixbufLoader* loader;
+    GdkPixbuf* pix = 0;
+    GdkPixbuf* scaled;
+    gint64 startTime;
+    int ok;
+
+    /* Nowhere to show it yet, or it would only make an extra window */
+    if (!gWin || gMakeNewWindows)
+        return -1;
+
+    /* ReadExifRotation may have used what it read the first time */
+    if (!ExifInfoIsFor(img->filename))
+        ExifReadInfo(img->filename);
+    thumbData = ExifGetThumbnail(&thumbSize);
+    ExifGetImageSize(&width, &height);
+    if (!thumbData || width <= 0 || height <= 0)
+        return -1;
+
+    startTime = g_get_monotonic_time();
+
+    loader = gdk_pixbuf_loader_new();
+    ok = gdk_pixbuf_loader_write(loader, thumbData, thumbSize, 0);
+    if (!gdk_pixbuf_loader_close(loader, 0))
+        ok = 0;
+    if (ok && (pix = gdk_pixbuf_loader_get_pixbuf(loader)) != 0)
+        g_object_ref(pix);
+    g_object_unref(loader);
+    if (!pix)
+        return -1;
+
+    /* The thumbnail isn't rotated any more than the image is,
+     * or flipped either, so scale it to the unrotated size and
+     * rotate (and maybe flip) it.
+     */
+    if (img->exifMirror)
+        MarkMirrored(pix);
+    GetScaleParams(&params);
+    CalcScaledSize(&params, width, height, width, height, rot,
+                   &new_width, &new_height);
+    scaled = ScaleRotatePixbuf(pix, new_width, new_height, rot);
+    g_object_unref(pix);
+    if (!scaled)
+        return -1;
+    pix = scaled;
+
+    if (gImage)
+        g_object_unref(gImage);
+    gImage = pix;
+    img->curWidth = gdk_pixbuf_get_width(gImage);
+    img->curHeight = gdk_pixbuf_get_height(gImage);
+    if (rot % 180 != 0) {
+        img->trueWidth = height;
+        img->trueHeight = width;
+    }
+    else {
+        img->trueWidth = width;
+        img->trueHeight = height;
+    }
+    img->curRot = rot;
+
+    /* Get it on the screen now, not after the real image has loaded */
+    PrepareWindow();
+    gdk_window_process_all_updates();
+    gdk_flush();
+
+    if (gDebug)
+        printf("Thumbnail preview of %s took %ld msec\n", img->filename,
+               (long)((g_get_monotonic_time() - startTime) / 1000));
+    return 0;
+}
+
+/* Progressive loading: once the window is up, an image that isn't
+ * in the cache is read a chunk at a time from an idle handler, and
+ * each band the decoder finishes is drawn as soon as it's ready.
+ * That keeps pho responding to keys while a big image loads, so the
+ * user can move on to another image without waiting for this one.
+ *
+ * While it's loading, gImage is a screen-sized buffer the bands are
+ * drawn into. When it's done, the decoded image replaces it and goes
+ * through ScaleAndRotate like any other.
+ */
+#define LOAD_CHUNK_SIZE 65536
+
+/* If a load fails, what to try instead */
+typedef enum { LOAD_THIS, LOAD_NEXT, LOAD_PREV } LoadDirection;
+
+static PhoImage* sLoadImg = 0;     /* 0 if nothing is loading */
+static PhoImage* sLoadFrom = 0;    /* gCurImage before NextImage */
+static LoadDirection sLoadDirection = LOAD_THIS;
+static int sLoadRot = 0;
+static int sLoadPreviewed = 0;     /* gImage is a thumbnail preview */
+static FILE* sLoadFile = 0;
+static GdkPixbufLoader* sLoader = 0;
+static guint sLoadIdle = 0;
+static DecodeSizeInfo sLoadSize;
+static PhoScaleParams sLoadParams;
+static GdkPixbuf* sLoadDisplay = 0;   /* the buffer, while it's gImage */
+static int sLoadDisplayWidth, sLoadDisplayHeight;  /* before rotation */
+static gint64 sLoadStartTime;
+static int sLoadWriting = 0;      /* inside gdk_pixbuf_loader_write */
+
+/* The decoder knows how big the image is: make the buffer to draw into. */
+static void LoadAreaPrepared(GdkPixbufLoader* loader, gpointer data)
+{
+    PhoImage* img = sLoadImg;
+    GdkPixbuf* src = gdk_pixbuf_loader_get_pixbuf(loader);
+    GdkPixbuf* display;
+    int width, height;
+
+    if (!img || !src)
+        return;
+    MarkIfMirrored(src);
+
+    CalcScaledSize(&sLoadParams, sLoadSize.trueWidth, sLoadSize.trueHeight,
+                   gdk_pixbuf_get_width(src), gdk_pixbuf_get_height(src),
+                   sLoadRot, &sLoadDisplayWidth, &sLoadDisplayHeight);
+    if (sLoadRot % 180 != 0) {
+        width = sLoadDisplayHeight;
+        height = sLoadDisplayWidth;
+    }
+    else {
+        width = sLoadDisplayWidth;
+        height = sLoadDisplayHeight;
+    }
+    if (width < 1 || height < 1)
+        return;
+
+    display = gdk_pixbuf_new(GDK_COLORSPACE_RGB,
+                             gdk_pixbuf_get_has_alpha(src), 8, width, height);
+    if (!display)
+        return;
+
+    /* Start from the thumbnail preview if there was one, else black */
+    if (sLoadPreviewed && gImage)
+        gdk_pixbuf_scale(gImage, display, 0, 0, width, height, 0., 0.,
+                         (double)width / gdk_pixbuf_get_width(gImage),
+                         (double)height / gdk_pixbuf_get_height(gImage),
+                         GDK_INTERP_NEAREST);
+    else
+        gdk_pixbuf_fill(display, 0x000000ff);
+
+    if (gImage)
+        g_object_unref(gImage);
+    gImage = sLoadDisplay = display;
+    img->curWidth = width;
+    img->curHeight = height;
+    if (sLoadRot % 180 != 0) {
+        img->trueWidth = sLoadSize.trueHeight;
+        img->trueHeight = sLoadSize.trueWidth;
+    }
+    else {
+        img->trueWidth = sLoadSize.trueWidth;
+        img->trueHeight = sLoadSize.trueHeight;
+    }
+    img->curRot = sLoadRot;
+
+    PrepareWindow();
+    gdk_window_process_all_updates();
+}
+
+/* Some more of the image has been decoded: scale and rotate
+ * just that part into the buffer, and draw it.
+ */
+static void LoadAreaUpdated(GdkPixbufLoader* loader,
+                            gint x, gint y, gint width, gint height,
+                            gpointer data)
+{
+    GdkPixbuf* src = gdk_pixbuf_loader_get_pixbuf(loader);
+    GdkPixbuf* band;
+    int srcWidth, srcHeight;
+    int x0, y0, x1, y1, bandWidth, bandHeight, dstX, dstY;
+
+    if (!sLoadImg || !src || !sLoadDisplay || gImage != sLoadDisplay)
+        return;
+
+    srcWidth = gdk_pixbuf_get_width(src);
+    srcHeight = gdk_pixbuf_get_height(src);
+
+    /* The rectangle in the unrotated display buffer, rounded outward */
+    x0 = x * sLoadDisplayWidth / srcWidth;
+    y0 = y * sLoadDisplayHeight / srcHeight;
+    x1 = ((x + width) * sLoadDisplayWidth + srcWidth - 1) / srcWidth;
+    y1 = ((y + height) * sLoadDisplayHeight + srcHeight - 1) / srcHeight;
+    if (x1 > sLoadDisplayWidth) x1 = sLoadDisplayWidth;
+    if (y1 > sLoadDisplayHeight) y1 = sLoadDisplayHeight;
+    bandWidth = x1 - x0;
+    bandHeight = y1 - y0;
+    if (bandWidth < 1 || bandHeight < 1)
+        return;
+
+    /* Nearest is plenty for something that's only on screen until
+     * the load finishes, and doesn't smear in rows not decoded yet.
+     */
+    band = gdk_pixbuf_new(GDK_COLORSPACE_RGB, gdk_pixbuf_get_has_alpha(src),
+                          8, bandWidth, bandHeight);
+    if (!band)
+        return;
+    gdk_pixbuf_scale(src, band, 0, 0, bandWidth, bandHeight,
+                     (double)-x0, (double)-y0,
+                     (double)sLoadDisplayWidth / srcWidth,
+                     (double)sLoadDisplayHeight / srcHeight,
+                     GDK_INTERP_NEAREST);
+
+    /* Flipped, the band ends up at the other side of the buffer */
+    if (IsMirrored(src)) {
+        int flippedX0 = sLoadDisplayWidth - x1;
+        x1 = sLoadDisplayWidth - x0;
+        x0 = flippedX0;
+        MarkMirrored(band);
+    }
+
+    switch (sLoadRot)
+    {
+      case 90:
+          dstX = sLoadDisplayHeight - y1;
+          dstY = x0;
+          break;
+      case 180:
+          dstX = sLoadDisplayWidth - x1;
+          dstY = sLoadDisplayHeight - y1;
+          break;
+      case 270:
+          dstX = y0;
+          dstY = sLoadDisplayWidth - x1;
+          break;
+      default:
+          dstX = x0;
+          dstY = y0;
+          break;
+    }
+    if (sLoadRot != 0 || IsMirrored(band)) {
+        GdkPixbuf* rotated = RotatePixbuf(band, sLoadRot);
+        g_object_unref(band);
+        if (!rotated)
+            return;
+        band = rotated;
+    }
+
+    bandWidth = gdk_pixbuf_get_width(band);
+    bandHeight = gdk_pixbuf_get_height(band);
+    gdk_pixbuf_copy_area(band, 0, 0, bandWidth, bandHeight,
+                         sLoadDisplay, dstX, dstY);
+    g_object_unref(band);
+
+    DrawImageArea(dstX, dstY, bandWidth, bandHeight);
+}
+
+/* Feed the next chunk of the file to the loader.
+ * Returns 1 if there's more to read, 0 at the end of the file,
+ * -1 on error.
+ */
+static int LoadNextChunk(GError** err)
+{
+    guchar buf[LOAD_CHUNK_SIZE];
+    size_t len = fread(buf, 1, sizeof buf, sLoadFile);
+    int ok;
+
+    if (len == 0) {
+        if (!ferror(sLoadFile))
+            return 0;
+        g_set_error(err, G_FILE_ERROR, G_FILE_ERROR_IO, "Read error");
+        return -1;
+    }
+    /* The loader's callbacks draw, which can mean expose events */
+    sLoadWriting = 1;
+    ok = gdk_pixbuf_loader_write(sLoader, buf, len, err);
+    sLoadWriting = 0;
+    return ok ? 1 : -1;
+}
+
+/* Tear down everything but sLoadImg; returns the finished pixbuf,
+ * if it's wanted and it loaded.
+ */
+static GdkPixbuf* StopLoading(int wantPixbuf, GError** err)
+{
+    GdkPixbuf* pix = 0;
+
+    if (sLoadIdle) {
+        g_source_remove(sLoadIdle);
+        sLoadIdle = 0;
+    }
+    if (sLoadFile) {
+        fclose(sLoadFile);
+        sLoadFile = 0;
+    }
+    if (sLoader) {
+        /* close has to be called even if we don't want the image */
+        if (gdk_pixbuf_loader_close(sLoader, wantPixbuf ? err : 0)
+            && wantPixbuf
+            && (pix = gdk_pixbuf_loader_get_pixbuf(sLoader)) != 0)
+            g_object_ref(pix);
+        g_object_unref(sLoader);
+        sLoader = 0;
+    }
+    sLoadDisplay = 0;
+    return pix;
+}
+
+/* Forget about any image that's loading. gImage may be left
+ * half drawn, but whatever gets loaded next will replace it.
+ * Returns 1 if there was a load to cancel.
+ */
+static int CancelProgressiveLoad()
+{
+    if (!sLoadImg)
+        return 0;
+    if (gDebug)
+        printf("Cancelling load of %s\n", sLoadImg->filename);
+    StopLoading(0, 0);
+    sLoadImg = 0;
+    return 1;
+}
+
+/* The file has all been read, or there was an error reading it.
+ * Show the image the normal way; or if it didn't load, move on
+ * the way NextImage/PrevImage/ThisImage would have.
+ */
+static void CompleteLoad(int ok, GError* err)
+{
+    PhoImage* img = sLoadImg;
+    GdkPixbuf* pix;
+
+    if (!img)
+        return;
+    if (ok)
+        pix = StopLoading(1, &err);
+    else
+        pix = StopLoading(0, 0);
+    sLoadImg = 0;
+
+    if (!pix) {
+        fprintf(stderr, "Can't open %s: %s\n", img->filename,
+                err ? err->message : "Couldn't load image");
+        if (err)
+            g_error_free(err);
+
+        if (sLoadDirection == LOAD_PREV)
+            PrevImage();
+        else if (sLoadDirection == LOAD_NEXT) {
+            if (gDebug)
+                printf("Skipping '%s' (didn't load)\n", img->filename);
+            DeleteItem(img);
+            gCurImage = sLoadFrom;
+            NextImage();
+        }
+        else
+            NextImage();
+        return;
+    }
+
+    if (gDebug)
+        printf("Progressive load of %s took %ld msec\n", img->filename,
+               (long)((g_get_monotonic_time() - sLoadStartTime) / 1000));
+
+    MarkIfMirrored(pix);
+    if (gImage)
+        g_object_unref(gImage);
+    gImage = pix;
+    ReadCaption(img);
+
+    img->curWidth = gdk_pixbuf_get_width(gImage);
+    img->curHeight = gdk_pixbuf_get_height(gImage);
+    img->trueWidth = sLoadSize.trueWidth;
+    img->trueHeight = sLoadSize.trueHeight;
+    img->curRot = 0;
+    if (img->curWidth == img->trueWidth && img->curHeight == img->trueHeight)
+        CacheAddMaster(img, gImage);
+
+    ScaleAndRotate(img, sLoadRot);
+    ShowImage();
+}
+
+static gboolean LoadIdle(gpointer data)
+{
+    GError* err = 0;
+    int status = LoadNextChunk(&err);
+
+    if (status > 0)
+        return TRUE;
+
+    sLoadIdle = 0;        /* returning FALSE removes it */
+    CompleteLoad(status == 0, err);
+    return FALSE;
+}
+
+/* Something needs the whole image right now: read the rest of it. */
+static void FinishProgressiveLoad()
+{
+    GError* err = 0;
+    int status;
+
+    /* Can't feed the loader from inside one of its own callbacks */
+    if (!sLoadImg || sLoadWriting)
+        return;
+    if (gDebug)
+        printf("Finishing load of %s right away\n", sLoadImg->filename);
+
+    while ((status = LoadNextChunk(&err)) > 0)
+        ;
+    CompleteLoad(status == 0, err);
+}
+
+/* Start loading img in the background, to be shown at rotation rot.
+ * Returns 0 if the load started, -1 if it couldn't.
+ */
+static int StartProgressiveLoad(PhoImage* img, int rot, int previewed,
+                                LoadDirection direction, PhoImage* from)
+{
+    sLoadFile = fopen(img->filename, "rb");
+    if (!sLoadFile)
+        return -1;
+
+    GetScaleParams(&sLoadParams);
+    sLoadSize.params = &sLoadParams;
+    sLoadSize.rot = rot;
+    sLoadSize.trueWidth = sLoadSize.trueHeight = 0;
+
+    sLoader = gdk_pixbuf_loader_new();
+    g_signal_connect(G_OBJECT(sLoader), "size-prepared",
+                     G_CALLBACK(DecodeSizePrepared), &sLoadSize);
+    g_signal_connect(G_OBJECT(sLoader), "area-prepared",
+                     G_CALLBACK(LoadAreaPrepared), 0);
+    g_signal_connect(G_OBJECT(sLoader), "area-updated",
+                     G_CALLBACK(LoadAreaUpdated), 0);
+
+    sLoadImg = img;
+    sLoadFrom = from;
+    sLoadDirection = direction;
+    sLoadRot = rot;
+    sLoadPreviewed = previewed;
+    sLoadDisplay = 0;
+    sLoadStartTime = g_get_monotonic_time();
+
+    /* Until the buffer is ready, gImage has to match img's size,
+     * so only the preview can stay.
+     */
+    if (!previewed && gImage) {
+        g_object_unref(gImage);
+        gImage = 0;
+    }
+
+    if (gDebug)
+        printf("Loading %s progressively\n", img->filename);
+
+    /* Lower priority than redraws and events, so keys still work */
+    sLoadIdle = g_idle_add(LoadIdle, 0);
+    return 0;
+}
+
+/* Load img, and show it at its saved rotation (or EXIF rotation
+ * if it's never been shown). Returns 0 if it's loaded,
+ * 1 if it's loading in the background and will be shown when it's
+ * done, or -1 if it couldn't be loaded.
+ * direction and from say what to do if a background load fails.
+ */
+static int LoadImageAndRotate(PhoImage* img, LoadDirection direction,
+                              PhoImage* from)
 {
     int e;
     int rot = (img ? img->curRot : 0);
     int firsttime = (img && (img->trueWidth == 0));
+    int previewed = 0;
 
     if (!img) return -1;
 
-    img->trueWidth = img->trueHeight = img->curRot = 0;
+    /* Whatever was loading before isn't wanted any more */
+    CancelProgressiveLoad();
 
-    e = LoadImageFromFile(img);
-    if (e) return e;
+    if (LoadCachedImage(img, firsttime) == 0) {
+        ScaleAndRotate(img, 0);
+        return 0;
+    }
 
     /* If it's not the first time we've loaded this image,
      * default its rotation to the EXIF rotation if any.
      * Otherwise rotate to the saved img->curRot.
      */
     if (firsttime && img->exifRot != 0)
-        ScaleAndRotate(gCurImage, img->exifRot);
+        rot = img->exifRot;
 
-    else
-        ScaleAndRotate(gCurImage, rot);
+    /* LoadCachedImage already got the EXIF rotation */
+    if (gThumbPreview)
+        previewed = (ShowThumbnailPreview(img, rot) == 0);
+
+    img->trueWidth = img->trueHeight = img->curRot = 0;
+
+    /* Once there's a window to draw in, load a bit at a time */
+    if (gWin && GTK_WIDGET_MAPPED(gWin) && !gMakeNewWindows
+        && StartProgressiveLoad(img, rot, previewed, direction, from) == 0)
+        return 1;
+
+    e = LoadImageFromFile(img, rot);
+    if (e) return e;
+
+    ScaleAndRotate(gCurImage, rot);
 
     return 0;
 }
@@ -157,12 +884,97 @@ static int LoadImageAndRotate(PhoImage* img)
  */
 int ThisImage()
 {
-    if (LoadImageAndRotate(gCurImage) != 0)
+    int e = LoadImageAndRotate(gCurImage, LOAD_THIS, gCurImage);
+    if (e < 0)
         return NextImage();
-    ShowImage();
+    if (e == 0)
+        ShowImage();
     return 0;
 }
 
+/* Keyboard navigation is queued, so that when a key is held down and
+ * the autorepeats come in faster than images can be loaded, pho goes
+ * straight to where the user ends up instead of loading and showing
+ * every image along the way.
+ */
+static int sPendingSteps = 0;
+static guint sNavigateIdle = 0;
+
+static gboolean NavigateIdle(gpointer data)
+{
+    int steps = sPendingSteps;
+    PhoImage* origImage = gCurImage;
+    int cancelled = 0;
+    int e = 0;
+
+    sPendingSteps = 0;
+    sNavigateIdle = 0;
+
+    /* The keys may have cancelled each other out */
+    if (steps == 0)
+        return FALSE;
+
+    if (gDebug && (steps > 1 || steps < -1))
+        printf("Skipping %d images at once\n", steps);
+
+    /* Already at that end of the list: leave whatever is showing,
+     * or still loading, alone.
+     */
+    if (gCurImage && (steps > 0 ? gCurImage->next == gFirstImage
+                                : gCurImage == gFirstImage))
+        e = -1;
+    else {
+        /* Whatever is loading now isn't where we're going */
+        cancelled = CancelProgressiveLoad();
+
+        /* Step over all but the last one without loading anything */
+        if (gCurImage)
+            gCurImage = NthImage(SkipIndex(ImageIndex(gCurImage), steps));
+        e = (steps > 0 ? NextImage() : PrevImage());
+    }
+
+    /* Nothing new is showing, so don't leave gCurImage on an image
+     * that was skipped over but never shown, and finish loading
+     * the one that is, if that was stopped.
+     */
+    if (e != 0) {
+        gCurImage = origImage;
+        if (cancelled && gCurImage)
+            ThisImage();
+    }
+    if (e != 0 && steps > 0) {
+        if (Prompt("Quit pho?", "Quit", "Continue", "qx \n", "cn") != 0)
+            EndSession();
+    }
+
+    return FALSE;
+}
+
+/* Move steps images forward (or backward, if negative)
+ * once the events already waiting have been handled.
+ */
+void QueueNavigation(int steps)
+{
+    sPendingSteps += steps;
+
+    /* Events come before this, so repeats pile up in sPendingSteps */
+    if (!sNavigateIdle)
+        sNavigateIdle = g_idle_add_full(G_PRIORITY_HIGH_IDLE,
+                                        NavigateIdle, 0, 0);
+}
+
+/* Forget any navigation that hasn't happened yet,
+ * e.g. because the user jumped somewhere else instead.
+ */
+void CancelNavigation()
+{
+    sPendingSteps = 0;
+    if (sNavigateIdle) {
+        g_source_remove(sNavigateIdle);
+        sNavigateIdle = 0;
+    }
+}
+
 /* Go to the next image after gCurImage,
  * or the first image if gCurImage isn't set. If an image fails to load,
  * delete it from the image list and move on to the next image.
@@ -173,6 +985,7 @@ int NextImage()
         printf("\n================= NextImage ====================\n");
 
     PhoImage* origCurImage = gCurImage;
+    int e;
 
     /* Loop, since images may fail to load
      * and may need to be deleted from the list
@@ -195,11 +1008,13 @@ int NextImage()
             return -1;
         }
         else {
-            gCurImage = gCurImage->next;
+            gCurImage = NthImage(ImageIndex(gCurImage) + 1);
         }
 
-        if (LoadImageAndRotate(gCurImage) == 0) {   /* Success! */
-            ShowImage();
+        e = LoadImageAndRotate(gCurImage, LOAD_NEXT, origCurImage);
+        if (e >= 0) {   /* Success! */
+            if (e == 0)     /* else ShowImage will be called when it's done */
+                ShowImage();
             return 0;
         }
 
@@ -213,86 +1028,25 @@ int NextImage()
 
 int PrevImage()
 {
+    int e;
+
     if (gDebug)
         printf("\n================= PrevImage ====================\n");
     do {
         if (gCurImage == 0) {  /* no image loaded yet, first call */
-            gCurImage = gFirstImage;
-            if (gCurImage->prev)
-                gCurImage = gCurImage->prev;
+            gCurImage = NthImage(CountImages() - 1);
         }
         else {
             if (gCurImage == gFirstImage)
                 return -1;  /* end of list */
             gCurImage = gCurImage->prev;
         }
-    } while (LoadImageAndRotate(gCurImage) != 0);
-    ShowImage();
+    } while ((e = LoadImageAndRotate(gCurImage, LOAD_PREV, 0)) < 0);
+    if (e == 0)
+        ShowImage();
     return 0;
 }
 
-int CountImages()
-{
-    if (!gFirstImage)
-        return 0;
-    int numImages = 1;
-    PhoImage* img = gFirstImage;
-    while (img->next != gFirstImage) {
-        ++numImages;
-        img = img->next;
-    }
-    return numImages;
-}
-
-void ShuffleArray(PhoImage** arr, int len)
-{
-    int i, j;
-    for (i = 0; i < len - 1; i++)
-    {
-        j = i + rand() / (RAND_MAX / (len - i) + 1);
-        PhoImage* tmp = arr[j];
-        arr[j] = arr[i];
-        arr[i] = tmp;
-    }
-}
-
-/* Randomize the image list. Does not change gCurImage. */
-void ShuffleImages()
-{
-    if (gDebug)
-        printf("Randomizing image order\n");
-
-    srand(time(NULL));
-
-    /* Now shuffle the list and replace it with the shuffled version. */
-
-    /* count total number of images */
-    int numImages = CountImages();
-    if (numImages < 2)
-        return;
-
-    /* make an array with pointers to each list element: */
-    PhoImage* imgarr[numImages];
-    int i;
-    PhoImage* curImg = gFirstImage;
-    for (i=0; i<numImages; ++i) {
-        imgarr[i] = curImg;
-        curImg = curImg->next;
-    }
-
-    ShuffleArray(imgarr, numImages);
-
-    gFirstImage = curImg = imgarr[0];
-    for (i=0; i<numImages; ++i) {
-        PhoImage* lastImg = curImg;
-        curImg = imgarr[i];
-        lastImg->next = curImg;
-        curImg->prev = lastImg;
-    }
-    /* fill in the last image's next */
-    curImg->next = gFirstImage;
- }
-
 /* Limit new_width and new_height so that they're no bigger than
  * max_width and max_height. This doesn't actually scale, just
  * calculates dimensions and returns them in *width and *height.
@@ -361,88 +1115,95 @@ static void ScaleToFit(int *width, int *height,
 #define SWAP(a, b) { int temp = a; a = b; b = temp; }
 /*#define SWAP(a, b)  {a ^= b; b ^= a; a ^= b;}*/
 
-/* Rotate the image according to the current scale mode, scaling as needed,
- * then redisplay.
- * 
- * This will read the image from disk if necessary,
- * and it will rotate the image at the appropriate time
- * (when the image is at its smallest).
- *
- * This is the routine that should be called by external callers:
- * callers should never need to call RotateImage.
- *
- * degrees is the increment from the current rotation (curRot).
- */
-int ScaleAndRotate(PhoImage* img, int degrees)
+/* Fill in params from the current view mode globals. */
+void GetScaleParams(PhoScaleParams* params)
 {
-#define true_width img->trueWidth
-#define true_height img->trueHeight
-    int new_width;
-    int new_height;
-
-    if (gDebug)
-        printf("ScaleAndRotate(%d (cur = %d))\n", degrees, img->curRot);
-
-    /* degrees should be between 0 and 360 */
-    degrees = (degrees + 360) % 360;
-
-    /* First, load the image if we haven't already, to get true w/h */
-    if (true_width == 0 || true_height == 0) {
-        if (gDebug) printf("Loading, first time, from ScaleAndRotate!\n");
-        LoadImageFromFile(img);
+    /* If we're in fixed mode, make sure we've set the "scale ratio"
+     * to the screen size:
+     */
+    if (gScaleMode == PHO_SCALE_FIXED && gScaleRatio == 0.0)
+        gScaleRatio = FracOfScreenSize();
+
+    params->scaleMode = gScaleMode;
+    params->scaleRatio = gScaleRatio;
+    params->monitorWidth = gMonitorWidth;
+    params->monitorHeight = gMonitorHeight;
+
+    /* If we're in presentation mode, then fullscreen needs to scale
+     * to the current size of the window, not the monitor,
+     * because in xinerama gdk_window_fullscreen() will fullscreen
+     * onto only one monitor, but gdk_screen_width() gives the
+     * width of the full xinerama setup.
+     */
+    if (gDisplayMode == PHO_DISPLAY_PRESENTATION && gWin)
+        gtk_window_get_size(GTK_WINDOW(gWin),
+                            &params->screenWidth, &params->screenHeight);
+    else {
+        params->screenWidth = gMonitorWidth;
+        params->screenHeight = gMonitorHeight;
     }
+}
 
-    /*
-     * Calculate new_width and new_height, the size to which the image
-     * should be scaled before or after rotation,
-     * based on the current scale mode.
-     * That means that if the aspect ratio is changing,
-     * new_width will be the image's height after rotation.
-     */
+int SameScaleParams(PhoScaleParams* a, PhoScaleParams* b)
+{
+    return (a->scaleMode == b->scaleMode
+            && a->scaleRatio == b->scaleRatio
+            && a->monitorWidth == b->monitorWidth
+            && a->monitorHeight == b->monitorHeight
+            && a->screenWidth == b->screenWidth
+            && a->screenHeight == b->screenHeight);
+}
 
+/*
+ * Calculate new_width and new_height, the size to which an image
+ * should be scaled before or after rotation, based on the scale mode
+ * in params. That means that if the aspect ratio is changing,
+ * new_width will be the image's height after rotation.
+ *
+ * This doesn't look at any globals, so it's safe from other threads.
+ */
+void CalcScaledSize(PhoScaleParams* params,
+                    int true_width, int true_height,
+                    int cur_width, int cur_height, int degrees,
+                    int* new_width, int* new_height)
+{
     /* Fullsize: display always at real resolution,
      * even if it's too big to fit on the screen.
      */
-    if (gScaleMode == PHO_SCALE_FULLSIZE) {
-        new_width = true_width * gScaleRatio;
-        new_height = true_height * gScaleRatio;
-        if (gDebug) printf("Now fullsize, %dx%d\n", new_width, new_height);
+    if (params->scaleMode == PHO_SCALE_FULLSIZE) {
+        *new_width = true_width * params->scaleRatio;
+        *new_height = true_height * params->scaleRatio;
+        if (gDebug) printf("Now fullsize, %dx%d\n", *new_width, *new_height);
     }
 
     /* Normal: display at full size unless it won't fit the screen,
      * in which case scale it down.
      */
 #define NORMAL_SCALE_SLOP 5
-    else if (gScaleMode == PHO_SCALE_NORMAL
-             || gScaleMode == PHO_SCALE_SCREEN_RATIO
-             || gScaleMode == PHO_SCALE_FIXED)
+    else if (params->scaleMode == PHO_SCALE_NORMAL
+             || params->scaleMode == PHO_SCALE_SCREEN_RATIO
+             || params->scaleMode == PHO_SCALE_FIXED)
     {
         int max_width, max_height;
         int aspect_changing;    /* Is the aspect ratio changing? */
 
-        new_width = true_width;
-        new_height = true_height;
+        *new_width = true_width;
+        *new_height = true_height;
 
         aspect_changing = ((degrees % 180) != 0);
         if (aspect_changing) {
-            max_width = gMonitorHeight;
-            max_height = gMonitorWidth;
+            max_width = params->monitorHeight;
+            max_height = params->monitorWidth;
             if (gDebug)
                 printf("Aspect ratio is changing\n");
         } else {
-            max_width = gMonitorWidth;
-            max_height = gMonitorHeight;
+            max_width = params->monitorWidth;
+            max_height = params->monitorHeight;
         }
 
-        /* If we're in fixed mode, make sure we've set the "scale ratio"
-         * to the screen size:
-         */
-        if (gScaleMode == PHO_SCALE_FIXED && gScaleRatio == 0.0)
-            gScaleRatio = FracOfScreenSize();
-
-        if (new_width > max_width || new_height > max_height) {
-            ScaleToFit(&new_width, &new_height, max_width, max_height,
-                       gScaleMode, gScaleRatio);
+        if (*new_width > max_width || *new_height > max_height) {
+            ScaleToFit(new_width, new_height, max_width, max_height,
+                       params->scaleMode, params->scaleRatio);
         }
 
 #if 0
@@ -450,33 +1211,33 @@ int ScaleAndRotate(PhoImage* img, int degrees)
          * scale verticals (assuming a landscape screen) down -- it's
          * better to keep the max dimension of each image the same.
          */
-        if (new_width <= max_height && new_height <= max_width) {
+        if (*new_width <= max_height && *new_height <= max_width) {
             double r = 
         } else {
-            new_width *= gScaleRatio;
-            new_height *= gScaleRatio;
+            *new_width *= params->scaleRatio;
+            *new_height *= params->scaleRatio;
         }
 #endif
 
         /* See if new_width and new_height are close enough already
          * that it might not be worth doing the work of scaling:
          */
-        if (abs(img->curWidth - new_width) + abs(img->curHeight - new_height)
+        if (abs(cur_width - *new_width) + abs(cur_height - *new_height)
             < NORMAL_SCALE_SLOP) {
-            new_width = img->curWidth;
-            new_height = img->curHeight;
+            *new_width = cur_width;
+            *new_height = cur_height;
         }
     }
 
-    else if (gScaleMode == PHO_SCALE_IMG_RATIO) {
-        new_width = true_width * gScaleRatio;
-        new_height = true_height * gScaleRatio;
+    else if (params->scaleMode == PHO_SCALE_IMG_RATIO) {
+        *new_width = true_width * params->scaleRatio;
+        *new_height = true_height * params->scaleRatio;
 
         /* See if we're close */
-        if (abs(img->curWidth - new_width) + abs(img->curHeight - new_height)
+        if (abs(cur_width - *new_width) + abs(cur_height - *new_height)
             < NORMAL_SCALE_SLOP) {
-            new_width = img->curWidth;
-            new_height = img->curHeight;
+            *new_width = cur_width;
+            *new_height = cur_height;
         }
     }
 
@@ -484,45 +1245,114 @@ int ScaleAndRotate(PhoImage* img, int degrees)
      * the largest dimension match the screen size.
      */
 #define FULLSCREEN_SCALE_SLOP 20
-    else if (gScaleMode == PHO_SCALE_FULLSCREEN) {
-        /* If we're in presentation mode, then we need to scale
-         * to the current size of the window, not the monitor,
-         * because in xinerama gdk_window_fullscreen() will fullscreen
-         * onto only one monitor, but gdk_screen_width() gives the
-         * width of the full xinerama setup.
+    else if (params->scaleMode == PHO_SCALE_FULLSCREEN) {
+        /* In presentation mode, screenWidth and screenHeight are
+         * the size of the window, which may not be the whole monitor.
          */
-        int diffx = abs(img->curWidth - gMonitorWidth);
-        int diffy = abs(img->curHeight - gMonitorHeight);
+        int diffx = abs(cur_width - params->monitorWidth);
+        int diffy = abs(cur_height - params->monitorHeight);
         double xratio, yratio;
-        gint screenwidth, screenheight;
-
-        if (gDisplayMode == PHO_DISPLAY_PRESENTATION)
-            gtk_window_get_size(GTK_WINDOW(gWin), &screenwidth, &screenheight);
-        else {
-            screenwidth = gMonitorWidth;
-            screenheight = gMonitorHeight;
-        }
 
         if (diffx < FULLSCREEN_SCALE_SLOP || diffy < FULLSCREEN_SCALE_SLOP) {
-            new_width = img->curWidth;
-            new_height = img->curHeight;
+            *new_width = cur_width;
+            *new_height = cur_height;
         }
         else {
-            xratio = (double)screenwidth / true_width;
-            yratio = (double)screenheight / true_height;
+            xratio = (double)params->screenWidth / true_width;
+            yratio = (double)params->screenHeight / true_height;
 
             /* Use xratio for the more extreme of the two */
             if (xratio > yratio) xratio = yratio;
-            new_width = xratio * true_width;
-            new_height = xratio * true_height;
+            *new_width = xratio * true_width;
+            *new_height = xratio * true_height;
         }
     }
     else {
         /* Shouldn't ever happen, means gScaleMode is bogus */
-        printf("Internal error: Unknown scale mode %d\n", gScaleMode);
-        new_width = img->curWidth;
-        new_height = img->curHeight;
+        printf("Internal error: Unknown scale mode %d\n", params->scaleMode);
+        *new_width = cur_width;
+        *new_height = cur_height;
     }
+}
+
+/* Rotate the image according to the current scale mode, scaling as needed,
+ * then redisplay.
+ * 
+ * This will read the image from disk if necessary,
+ * and it will rotate the image at the appropriate time
+ * (when the image is at its smallest).
+ *
+ * This is the routine that should be called by external callers:
+ * callers should never need to call RotateImage.
+ *
+ * degrees is the increment from the current rotation (curRot).
+ */
+int ScaleAndRotate(PhoImage* img, int degrees)
+{
+#define true_width img->trueWidth
+#define true_height img->trueHeight
+    int new_width;
+    int new_height;
+    int viewRot;
+    PhoScaleParams params;
+
+    if (gDebug)
+        printf("ScaleAndRotate(%d (cur = %d))\n", degrees, img->curRot);
+
+    /* If it's still loading, it has to finish first */
+    if (img && img == sLoadImg) {
+        FinishProgressiveLoad();
+        /* If it couldn't finish yet, or didn't load (in which case
+         * it may not even exist any more), leave it alone.
+         */
+        if (img == sLoadImg || img != gCurImage)
+            return -1;
+    }
+
+    /* If gImage is only being rotated when it's drawn, go back to
+     * what it really is, and fold that rotation into this one.
+     */
+    viewRot = ViewRotation();
+    if (viewRot != 0) {
+        ClearViewRotation();
+        img->curRot = (img->curRot - viewRot + 360) % 360;
+        if (viewRot % 180 != 0) {
+            SWAP(img->curWidth, img->curHeight);
+            SWAP(true_width, true_height);
+        }
+        degrees += viewRot;
+    }
+
+    /* Likewise if gImage is only a quick scale: start over from
+     * what it was scaled from -- unless that would just scale it
+     * to the same size again, e.g. from ShowImage right after
+     * loading. Then keep it, and let the pending refine finish.
+     */
+    if (degrees % 360 != 0 || !QuickScaleStillRight(img))
+        degrees += UndoQuickScale(img);
+
+    /* degrees should be between 0 and 360 */
+    degrees = (degrees + 360) % 360;
+
+    /* If it's tiled, curWidth and curHeight are the size it's
+     * pretending to be; what we actually have is gImage.
+     */
+    if (TilesActive()) {
+        img->curWidth = gdk_pixbuf_get_width(gImage);
+        img->curHeight = gdk_pixbuf_get_height(gImage);
+    }
+
+    /* First, load the image if we haven't already, to get true w/h */
+    if (true_width == 0 || true_height == 0) {
+        if (gDebug) printf("Loading, first time, from ScaleAndRotate!\n");
+        LoadImageFromFile(img, degrees);
+    }
+
+    GetScaleParams(&params);
+    CalcScaledSize(&params, true_width, true_height,
+                   img->curWidth, img->curHeight, degrees,
+                   &new_width, &new_height);
+
     /*
      * Finally, we're done with the scaling modes.
      * Time to do the scaling and rotation,
@@ -559,8 +1389,27 @@ int ScaleAndRotate(PhoImage* img, int degrees)
             /* Now it's the absolute end rot desired */
 
         img->curRot = 0;
-        LoadImageFromFile(img);
+        ReloadImage(img, degrees);
     }
+
+    /* If it would be too big to scale all at once, rotate what we have
+     * and let DrawImage scale just the tiles that end up on screen.
+     */
+    if (TooBigToScale(&params, new_width, new_height,
+                      img->curWidth, img->curHeight)) {
+        if (degrees != 0 || IsMirrored(gImage))
+            RotateImage(img, degrees);
+        if (degrees % 180 != 0)
+            SWAP(new_width, new_height);
+        TilesSetSource(gImage, new_width, new_height);
+        img->curWidth = new_width;
+        img->curHeight = new_height;
+
+        /* Tiled images don't go in the cache: they're too big */
+        PrepareWindow();
+        return 0;
+    }
+    TilesClear();
 #if 0
     else if (degrees % 180 != 0) {
         SWAP(new_width, new_height);
@@ -584,14 +1433,20 @@ int ScaleAndRotate(PhoImage* img, int degrees)
     }
 #endif
 
-    /* Do the scaling (thought we'd never get there!) */
+    /* Do the scaling (thought we'd never get there!)
+     * If it needs rotating too, that happens in the same pass.
+     * A big image gets a quick scale now, and a good one later.
+     */
     if (new_width != img->curWidth || new_height != img->curHeight)
     {
-        GdkPixbuf* newimage = gdk_pixbuf_scale_simple(gImage,
-                                                      new_width,
-                                                      new_height,
-                                                      GDK_INTERP_BILINEAR);
-        /* If that's too slow use GDK_INTERP_NEAREST */
+        GdkPixbuf* oldimage = gImage;
+        int quick = ((long)img->curWidth * img->curHeight
+                     > QUICK_SCALE_PIXELS);
+        GdkPixbuf* newimage = (quick ? QuickScaleRotatePixbuf
+                                     : ScaleRotatePixbuf)(gImage,
+                                                          new_width,
+                                                          new_height,
+                                                          degrees);
 
         /* scale_simple apparently has no error return; if it fails,
          * it still returns a pixbuf but width and height are -1.
@@ -614,18 +1469,42 @@ int ScaleAndRotate(PhoImage* img, int degrees)
                    new_width, new_height,
                    gdk_pixbuf_get_width(newimage),
                    gdk_pixbuf_get_height(newimage));
-        if (gImage)
-            g_object_unref(gImage);
         gImage = newimage;
+        if (quick)
+            RememberQuickScale(oldimage, degrees);
+        if (oldimage)
+            g_object_unref(oldimage);
 
         img->curWidth = gdk_pixbuf_get_width(gImage);
         img->curHeight = gdk_pixbuf_get_height(gImage);
+
+        if (degrees != 0) {
+            if (degrees % 180 != 0)
+                SWAP(true_width, true_height);
+            img->curRot = (img->curRot + degrees) % 360;
+            degrees = 0;    /* finished with rotation */
+        }
     }
 
-    /* If we didn't rotate before, do it now. */
-    if (degrees != 0)
+    /* DrawImage can rotate but not flip, so a mirror image that
+     * didn't need scaling has to be flipped (and rotated) now.
+     */
+    if (IsMirrored(gImage))
         RotateImage(img, degrees);
 
+    /* If we didn't rotate before, let DrawImage do it for now:
+     * the real rotation can wait until there's nothing else to do.
+     */
+    else if (degrees != 0)
+        RotateAtDrawTime(img, degrees);
+
+    /* Remember it in this form, in case we come back to it.
+     * (If it's rotated at draw time or only a quick scale,
+     * that happens once it's real.)
+     */
+    if (ViewRotation() == 0 && !QuickScaleShowing())
+        CacheAdd(img, gImage, img->curRot, img->trueWidth, img->trueHeight);
+
     /* We've finished making our changes. Now we may need to make
      * changes in the window size or position.
      */
@@ -653,6 +1532,8 @@ void ReallyDelete(PhoImage* delImg)
         return;
     }
 
+    if (delImg == sLoadImg)
+        CancelProgressiveLoad();
     DeleteItem(delImg);
 
     /* If we just deleted the only image, all we can do is quit */
@@ -672,6 +1553,218 @@ void DeleteImage(PhoImage* delImg)
         ReallyDelete(delImg);
 }
 
+/* Pressing a rotate key shouldn't have to wait for every pixel
+ * to be copied. So when ScaleAndRotate only has to rotate, it updates
+ * img as if gImage had been rotated, and DrawImage draws gImage
+ * rotated by ViewRotation() degrees. The real rotation happens later
+ * in an idle handler, which also puts the result in the cache.
+ *
+ * The view rotation only counts while gImage is still the pixbuf it
+ * was meant for. Holding a reference on it means nothing else can
+ * turn up at the same address, so anything that replaces gImage
+ * cancels it without having to know about it.
+ */
+static GdkPixbuf* sViewRotImage = 0;
+static int sViewRot = 0;
+static guint sViewRotIdle = 0;
+
+static void ClearViewRotation()
+{
+    if (sViewRotImage)
+        g_object_unref(sViewRotImage);
+    sViewRotImage = 0;
+    sViewRot = 0;
+}
+
+int ViewRotation()
+{
+    if (sViewRotImage && sViewRotImage != gImage)
+        ClearViewRotation();
+    return sViewRot;
+}
+
+/* Idle handler: rotate gImage for real. It looks the same on screen,
+ * so there's no need to redraw.
+ */
+static gboolean ApplyViewRotation(gpointer data)
+{
+    int rot = ViewRotation();
+    GdkPixbuf* rotated;
+
+    sViewRotIdle = 0;
+    if (rot == 0 || !gCurImage)
+        return FALSE;
+
+    /* Let go of it first, so it can be rotated in place if it's huge */
+    ClearViewRotation();
+    rotated = RotatePixbufInPlace(gImage, rot);
+    if (rotated)
+        ForgetImagePixmap();
+    else
+        rotated = RotatePixbuf(gImage, rot);
+    if (!rotated) {
+        /* Keep drawing it rotated */
+        sViewRotImage = g_object_ref(gImage);
+        sViewRot = rot;
+        return FALSE;
+    }
+
+    g_object_unref(gImage);
+    gImage = rotated;
+    CacheAdd(gCurImage, gImage, gCurImage->curRot,
+             gCurImage->trueWidth, gCurImage->trueHeight);
+    return FALSE;
+}
+
+static void RotateAtDrawTime(PhoImage* img, int degrees)
+{
+    degrees = (degrees + 360) % 360;
+    if (degrees == 0 || !gImage)
+        return;
+
+    if (gDebug)
+        printf("Rotating %d at draw time\n", degrees);
+
+    if (degrees % 180 != 0) {
+        SWAP(img->curWidth, img->curHeight);
+        SWAP(img->trueWidth, img->trueHeight);
+    }
+    img->curRot = (img->curRot + degrees) % 360;
+
+    if (sViewRotImage != gImage) {
+        ClearViewRotation();
+        sViewRotImage = g_object_ref(gImage);
+    }
+    sViewRot = (sViewRot + degrees) % 360;
+
+    if (!sViewRotIdle)
+        sViewRotIdle = g_idle_add_full(G_PRIORITY_LOW, ApplyViewRotation,
+                                       0, 0);
+}
+
+/* Scaling a big image well takes long enough to notice. So
+ * ScaleAndRotate shows a quick nearest-neighbour scale right away,
+ * and the real scale happens in an idle handler, which swaps it in
+ * if gImage is still the quick one, and puts it in the cache.
+ * sQuickImage is the quick gImage (held for the same reason as
+ * sViewRotImage), sQuickSource what it was scaled from, and
+ * sQuickRot the rotation that was done along with the scale.
+ */
+static GdkPixbuf* sQuickImage = 0;
+static GdkPixbuf* sQuickSource = 0;
+static int sQuickRot = 0;
+static guint sRefineIdle = 0;
+
+static void ClearQuickScale()
+{
+    if (sQuickImage)
+        g_object_unref(sQuickImage);
+    if (sQuickSource)
+        g_object_unref(sQuickSource);
+    sQuickImage = sQuickSource = 0;
+    sQuickRot = 0;
+}
+
+static int QuickScaleShowing()
+{
+    if (sQuickImage && sQuickImage != gImage)
+        ClearQuickScale();
+    return sQuickImage != 0;
+}
+
+/* Idle handler: do the scale properly, and show that instead. */
+static gboolean RefineQuickScale(gpointer data)
+{
+    GdkPixbuf* refined;
+    int width, height;
+
+    sRefineIdle = 0;
+    if (!QuickScaleShowing() || !gCurImage)
+        return FALSE;
+
+    /* The same size, before rotation */
+    width = gdk_pixbuf_get_width(gImage);
+    height = gdk_pixbuf_get_height(gImage);
+    if (sQuickRot % 180 != 0)
+        SWAP(width, height);
+
+    refined = ScaleRotatePixbuf(sQuickSource, width, height, sQuickRot);
+    ClearQuickScale();
+    if (!refined)
+        return FALSE;    /* the quick one will have to do */
+
+    g_object_unref(gImage);
+    gImage = refined;
+    CacheAdd(gCurImage, gImage, gCurImage->curRot,
+             gCurImage->trueWidth, gCurImage->trueHeight);
+    ScheduleDraw();
+    return FALSE;
+}
+
+/* gImage was just quickly scaled from source, rotating it by degrees */
+static void RememberQuickScale(GdkPixbuf* source, int degrees)
+{
+    ClearQuickScale();
+    sQuickImage = g_object_ref(gImage);
+    sQuickSource = g_object_ref(source);
+    sQuickRot = degrees;
+
+    if (!sRefineIdle)
+        sRefineIdle = g_idle_add_full(G_PRIORITY_LOW, RefineQuickScale,
+                                      0, 0);
+}
+
+/* Is gImage a quick scale, of the size ScaleAndRotate would make
+ * again from the quick scale's source?
+ */
+static int QuickScaleStillRight(PhoImage* img)
+{
+    PhoScaleParams params;
+    int trueWidth = img->trueWidth;
+    int trueHeight = img->trueHeight;
+    int width, height;
+
+    if (!QuickScaleShowing())
+        return 0;
+
+    /* As UndoQuickScale would leave them */
+    if (sQuickRot % 180 != 0)
+        SWAP(trueWidth, trueHeight);
+    GetScaleParams(&params);
+    CalcScaledSize(&params, trueWidth, trueHeight,
+                   gdk_pixbuf_get_width(sQuickSource),
+                   gdk_pixbuf_get_height(sQuickSource),
+                   sQuickRot, &width, &height);
+
+    /* That's before rotation; curWidth and curHeight are after */
+    if (sQuickRot % 180 != 0)
+        SWAP(width, height);
+    return (width == img->curWidth && height == img->curHeight);
+}
+
+/* If gImage is a quick scale, put back what it was scaled from and
+ * undo img's bookkeeping to match. Returns the rotation undone.
+ */
+static int UndoQuickScale(PhoImage* img)
+{
+    int rot;
+
+    if (!QuickScaleShowing())
+        return 0;
+
+    rot = sQuickRot;
+    g_object_unref(gImage);
+    gImage = g_object_ref(sQuickSource);
+    ClearQuickScale();
+
+    img->curWidth = gdk_pixbuf_get_width(gImage);
+    img->curHeight = gdk_pixbuf_get_height(gImage);
+    if (rot % 180 != 0)
+        SWAP(img->trueWidth, img->trueHeight);
+    img->curRot = (img->curRot - rot + 360) % 360;
+    return rot;
+}
+
 /* RotateImage just rotates an existing image, no scaling or reloading.
  * It's typically called from ScaleAndRotate either just
  * before or just after scaling.
@@ -680,9 +1773,6 @@ void DeleteImage(PhoImage* delImg)
  */
 static int RotateImage(PhoImage* img, int degrees)
 {
-    guchar *oldpixels, *newpixels;
-    int x, y;
-    int oldrowstride, newrowstride, nchannels, bitsper, alpha;
     int newWidth, newHeight, newTrueWidth, newTrueHeight;
     GdkPixbuf* newImage;
 
@@ -696,8 +1786,10 @@ static int RotateImage(PhoImage* img, int degrees)
     /* Make sure degrees is between 0 and 360 even if it's -90 */
     degrees = (degrees + 360) % 360;
 
-    /* degrees might be zero now, since we might be rotating back to zero. */
-    if (degrees == 0) {
+    /* degrees might be zero now, since we might be rotating back to zero.
+     * A mirror image still has to be flipped, though.
+     */
+    if (degrees == 0 && !IsMirrored(gImage)) {
         return 0;
     }
 
@@ -717,54 +1809,13 @@ static int RotateImage(PhoImage* img, int degrees)
         newTrueHeight = img->trueHeight;
     }
 
-    oldrowstride = gdk_pixbuf_get_rowstride(gImage);
-    /* Sometimes rowstride is slightly different from width*nchannels:
-     * gdk_pixbuf optimizes by aligning to 32-bit boundaries.
-     * But apparently it works even if rowstride is not aligned,
-     * just might not be as fast.
-     * XXX check newrowstride alignment
-     */
-    bitsper = gdk_pixbuf_get_bits_per_sample(gImage);
-    nchannels = gdk_pixbuf_get_n_channels(gImage);
-    alpha = gdk_pixbuf_get_has_alpha(gImage);
-
-    oldpixels = gdk_pixbuf_get_pixels(gImage);
-
-    newImage = gdk_pixbuf_new(GDK_COLORSPACE_RGB, alpha, bitsper,
-                              newWidth, newHeight);
+    /* A huge image can be rotated in place, if nothing else has it */
+    newImage = RotatePixbufInPlace(gImage, degrees);
+    if (newImage)
+        ForgetImagePixmap();
+    else
+        newImage = RotatePixbuf(gImage, degrees);
     if (!newImage) return 1;
-    newpixels = gdk_pixbuf_get_pixels(newImage);
-    newrowstride = gdk_pixbuf_get_rowstride(newImage);
-
-    for (x = 0; x < img->curWidth; ++x)
-    {
-        for (y = 0; y < img->curHeight; ++y)
-        {
-            int newx, newy;
-            int i;
-            switch (degrees)
-            {
-              case 90:
-                newx = img->curHeight - y - 1;
-                newy = x;
-                break;
-              case 270:
-                newx = y;
-                newy = img->curWidth - x - 1;
-                break;
-              case 180:
-                newx = img->curWidth - x - 1;
-                newy = img->curHeight - y - 1;
-                break;
-              default:
-                printf("Illegal rotation value!\n");
-                return 1;
-            }
-            for (i=0; i<nchannels; ++i)
-                newpixels[newy*newrowstride + newx*nchannels + i]
-                    = oldpixels[y*oldrowstride + x*nchannels + i];
-        }
-    }
 
     img->curWidth = newWidth;
     img->curHeight = newHeight;
@@ -788,10 +1839,16 @@ void Usage()
     printf("\t-P:  No presentation mode (separate window) -- default\n");
     printf("\t-k:  Keywords mode (show a Keywords dialog for each image)\n");
     printf("\t-R:  Randomize order in which images will be shown\n");
+    printf("\t-RN: Randomize order using seed N, to get the same order again\n");
     printf("\t-mN: Use monitor number N.\n");
     printf("\t-n:  Replace each image window with a new window (helpful for some window managers)\n");
     printf("\t-sN: Slideshow mode, where N is the timeout in seconds\n");
     printf("\t-r:  Repeat: loop back to the first image after showing the last\n");
+    printf("\t-t:  Show the EXIF thumbnail while each image loads\n");
+    printf("\t-M:  Keep full-resolution copies of images, for faster zooming in\n");
+    printf("\t-CN: Cache up to N megabytes of decoded images (default %d, 0 to disable)\n", gCacheMegabytes);
+    printf("\t-jN: Rotate and scale with N threads (default one per processor)\n");
+    printf("\t-Fpho, -Fgdk: Shrink images with pho's own filters, or gdk-pixbuf's (default)\n");
     printf("\t-cpattern: Caption/Comment file pattern, format string for reworking filename\n");
     printf("\t--:  Assume no more flags will follow\n");
     printf("\t-d:  Debug messages\n");
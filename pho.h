@@ -21,6 +21,7 @@ G_GNUC_END_IGNORE_DEPRECATIONS
  * gFirstImage is the beginning;
  * gFirstImage->prev is the last item,
  * lastImg->next is gFirstImage.
+ * They're also indexed by position: see NthImage().
  */
 typedef struct PhoImage_s {
     char* filename;
@@ -29,8 +30,12 @@ typedef struct PhoImage_s {
     int curWidth, curHeight;
     int curRot;       /* current rotation of the current image bits */
     int exifRot;      /* exif-specified rotation */
+    int exifMirror;   /* exif says it's a mirror image */
+    char* exifDate;   /* exif date, for the titlebar, or 0 */
+    int exifRead;     /* the three exif fields are filled in */
     unsigned long noteFlags;
     unsigned int deleted;
+    int index;        /* where it is in the list: see ImageIndex() */
     struct PhoImage_s* prev;
     struct PhoImage_s* next;
     char* comment;
@@ -106,6 +111,25 @@ extern int gScaleMode;
  */
 extern double gScaleRatio;
 
+/* Everything that goes into deciding how big an image should be shown.
+ * GetScaleParams() fills one in from the current globals;
+ * CalcScaledSize() uses only what's in it, so it's safe to call
+ * from the prefetch thread.
+ */
+typedef struct {
+    int scaleMode;
+    double scaleRatio;
+    int monitorWidth, monitorHeight;
+    int screenWidth, screenHeight;    /* area fullscreen mode fills */
+} PhoScaleParams;
+
+extern void GetScaleParams(PhoScaleParams* params);
+extern int SameScaleParams(PhoScaleParams* a, PhoScaleParams* b);
+extern void CalcScaledSize(PhoScaleParams* params,
+                           int true_width, int true_height,
+                           int cur_width, int cur_height, int degrees,
+                           int* new_width, int* new_height);
+
 /* ************** Display modes ************** */
 #define PHO_DISPLAY_NORMAL       0
 #define PHO_DISPLAY_PRESENTATION 1
@@ -123,7 +147,12 @@ extern double FracOfScreenSize();
 extern void DeleteItem(PhoImage* item);
 extern void AppendItem(PhoImage* item);
 extern void ClearImageList();
-extern void ShuffleImages();
+extern void ShuffleImages(guint32 seed);
+extern int CountImages();
+/* May shuffle more of the list first, if it's being shuffled */
+extern PhoImage* NthImage(int n);
+extern int ImageIndex(PhoImage* img);
+extern int SkipIndex(int from, int steps);
 
 /* ************** Misc. functions ************** */
 /* Some window managers don't deal well with windows that resize,
@@ -143,6 +172,9 @@ extern int gDelayMillis;
 /* Loop back to the first image after showing the last one */
 extern int gRepeat;
 
+/* Show the EXIF thumbnail while the real image is loading */
+extern int gThumbPreview;
+
 /* Get the keyword string associated with a note number */
 extern char* KeywordString(int notenum);
 
@@ -153,7 +185,19 @@ extern void SetKeywordsDialogToggle(int which, int newval);
 /* Other routines that need to be public */
 extern void PrepareWindow();
 extern void DrawImage();
+extern void ScheduleDraw();
+extern void DrawImageArea(int x, int y, int width, int height);
+/* gImage's pixels changed without gImage changing: don't draw the
+ * copies on the X server or in cairo any more.
+ */
+extern void ForgetImagePixmap();
 extern int ScaleAndRotate(PhoImage* img, int degrees);
+/* How much DrawImage has to rotate gImage by: 0 once it's really rotated */
+extern int ViewRotation();
+extern GdkPixbuf* LoadPixbufForDisplay(const char* filename,
+                                       PhoScaleParams* params, int rot,
+                                       int* trueWidth, int* trueHeight,
+                                       GError** err);
 
 extern PhoImage* AddImage(char* filename);
 extern void DeleteImage(PhoImage* img);
@@ -169,10 +213,172 @@ extern int NextImage();
 extern int PrevImage();
 extern int ThisImage();
 extern int ShowImage();
+extern void QueueNavigation(int steps);
+extern void CancelNavigation();
 
 extern void ToggleNoteFlag(PhoImage* img, int note);
 extern void InitNotes();
 extern void PrintNotes();
 
+/* ************** Prefetching (prefetch.c) ************** */
+/* Start decoding the images on either side of gCurImage,
+ * and gCurImage's master if we're keeping masters.
+ */
+extern void PrefetchNeighbors();
+
+/* If the prefetcher is in the middle of decoding img, wait for it
+ * and put the result in the cache.
+ */
+extern void PrefetchWait(PhoImage* img);
+
+/* The same, for a background decode of img's full-resolution master. */
+extern void PrefetchWaitMaster(PhoImage* img);
+
+/* Forget anything being prefetched for img, e.g. because it's
+ * being deleted.
+ */
+extern void PrefetchForget(PhoImage* img);
+
+/* ************** Image cache (imgcache.c) ************** */
+/* Memory budget for cached pixbufs, in megabytes */
+extern int gCacheMegabytes;
+
+/* Remember a display-ready pixbuf for img. rot is its rotation,
+ * trueWidth and trueHeight the full size of the image at that rotation.
+ */
+extern void CacheAdd(PhoImage* img, GdkPixbuf* pixbuf, int rot,
+                     int trueWidth, int trueHeight);
+
+/* Return a new reference to a cached pixbuf for img at rotation rot
+ * (-1 for any) which is already the right size for params, or 0.
+ */
+extern GdkPixbuf* CacheLookup(PhoImage* img, int rot, PhoScaleParams* params,
+                              int* trueWidth, int* trueHeight);
+extern int CacheHas(PhoImage* img, int rot, PhoScaleParams* params);
+
+/* Full-resolution, unrotated masters of images, kept with -M so
+ * zooming in doesn't have to read the file again.
+ */
+extern int gKeepMasters;
+extern void CacheAddMaster(PhoImage* img, GdkPixbuf* pixbuf);
+extern GdkPixbuf* CacheLookupMaster(PhoImage* img);
+extern int CacheHasMaster(PhoImage* img);
+extern void CacheForget(PhoImage* img);
+
+/* ************** Scaling (scale.c) ************** */
+/* Scale src to width x height, shrinking from a cached mip level
+ * when that's much smaller than src. Returns a new pixbuf, or 0.
+ */
+extern GdkPixbuf* ScalePixbuf(GdkPixbuf* src, int width, int height);
+
+/* Scale src to width x height (before rotation) and rotate the result
+ * by degrees, in one pass with no full-size pixbuf in between.
+ * With degrees 0, it's the same as ScalePixbuf. If src is marked
+ * as a mirror image, the result is flipped before it's rotated.
+ */
+extern GdkPixbuf* ScaleRotatePixbuf(GdkPixbuf* src, int width, int height,
+                                    int degrees);
+
+/* The same, but as fast as it can be: nearest neighbour, from a mip
+ * level only if src already has one. For something to show right
+ * away while the real one is made.
+ */
+extern GdkPixbuf* QuickScaleRotatePixbuf(GdkPixbuf* src,
+                                         int width, int height, int degrees);
+
+/* How much memory src's mip levels take so far, so the cache
+ * can count them against its budget.
+ */
+extern unsigned long MipBytes(GdkPixbuf* src);
+
+/* ************** Resampling (resample.c) ************** */
+/* What to shrink images with: gdk-pixbuf's bilinear scaler, or pho's
+ * own area-averaging and Lanczos filters.
+ */
+#define PHO_FILTER_GDK 0
+#define PHO_FILTER_PHO 1
+extern int gScaleFilter;
+
+/* A prepared shrink of src to width x height with pho's filters.
+ * NewResampler returns 0 if gScaleFilter says not to, or it isn't
+ * a shrink. ResampleRows writes output rows firstRow up to endRow
+ * to dst (row firstRow first), and returns 0 if it's out of memory;
+ * any number of threads can call it at once with the same Resampler.
+ */
+typedef struct Resampler_s Resampler;
+extern Resampler* NewResampler(GdkPixbuf* src, int width, int height);
+extern int ResampleRows(Resampler* r, guchar* dst, int dstrowstride,
+                        int firstRow, int endRow);
+extern void FreeResampler(Resampler* r);
+
+/* ************** Parallel bands (bands.c) ************** */
+/* Number of threads to rotate and scale with; 0 means one per processor */
+extern int gThreads;
+
+/* Do rows 0 up to rows of some job as bands of rows in parallel,
+ * each band a multiple of granularity rows, calling func(data,
+ * firstRow, endRow) once per band. Returns when every band is done.
+ */
+typedef void (*BandFunc)(gpointer data, int firstRow, int endRow);
+extern void RunInBands(BandFunc func, gpointer data, int rows,
+                       int granularity);
+
+/* ************** Rotation (rotate.c) ************** */
+/* Make a new pixbuf which is src rotated clockwise by degrees
+ * (0, 90, 180 or 270), or return 0 on failure. Thread-safe.
+ * If src is marked as a mirror image, it's flipped left to right
+ * first, and the new pixbuf isn't marked.
+ */
+extern GdkPixbuf* RotatePixbuf(GdkPixbuf* src, int degrees);
+
+/* The same, but reusing src's memory, for images so big that two
+ * copies might not fit. src's pixels are gone afterward. Returns 0
+ * (leaving src alone) if anything besides the caller holds src,
+ * or src is small enough that RotatePixbuf is the better choice.
+ */
+extern GdkPixbuf* RotatePixbufInPlace(GdkPixbuf* src, int degrees);
+
+/* Rotate a width x height block of pixels from src into dst,
+ * which has to have room for the rotated block, flipping it left
+ * to right first if mirror is set.
+ */
+extern void RotatePixels(const guchar* src, int srcrowstride,
+                         int width, int height, int nchannels, int degrees,
+                         int mirror, guchar* dst, int dstrowstride);
+
+/* EXIF orientations 2, 4, 5 and 7 are mirror images, which no decoder
+ * flips. Pixbufs straight from the decoder are marked if they need it,
+ * and the next RotatePixbuf or ScaleRotatePixbuf flips them.
+ * MarkIfMirrored() marks pix if its "orientation" option says so,
+ * and returns whether it did.
+ */
+extern void MarkMirrored(GdkPixbuf* pix);
+extern int IsMirrored(GdkPixbuf* pix);
+extern int MarkIfMirrored(GdkPixbuf* pix);
+
+/* ************** Sending pixels to the X server (upload.c) ************** */
+/* Like gdk_pixbuf_render_to_drawable, but through a MIT-SHM shared
+ * image when the display and the pixbuf allow it.
+ */
+extern void UploadPixbuf(GdkPixbuf* pix, GdkDrawable* drawable, GdkGC* gc,
+                         int srcX, int srcY, int dstX, int dstY,
+                         int width, int height);
+
+/* ************** Tiled drawing (tiles.c) ************** */
+/* Zooming far in would make gImage bigger than memory allows, so past
+ * a point (TooBigToScale) gImage stays at the source size and
+ * DrawImage scales only the tiles it needs (DrawTiles).
+ * While TilesActive(), gCurImage->curWidth/curHeight are the
+ * size of the virtual scaled image, not of gImage.
+ */
+extern int TooBigToScale(PhoScaleParams* params, int width, int height,
+                         int srcWidth, int srcHeight);
+extern int TilesActive();
+extern void TilesSetSource(GdkPixbuf* src, int width, int height);
+extern void TilesClear();
+extern void DrawTiles(GdkDrawable* drawable, GdkGC* gc,
+                      int originX, int originY,
+                      int areaX, int areaY, int areaWidth, int areaHeight);
+
 /* event handler. Ugh, this introduces gtk stuff */
 extern gint HandleGlobalKeys();
@@ -12,18 +12,209 @@
  *
  * gCurImage points to the current list item.
  *
+ * The same images are also kept in order in the array sImages,
+ * and each knows its place in it (->index), so counting them,
+ * finding the nth, or saying where one is doesn't walk the list,
+ * which may be a couple hundred thousand images long.
+ *
+ * Deleting an image just leaves a hole in sImages. The next time
+ * positions matter, CloseGaps() closes all the holes and renumbers
+ * what's after them in one pass, so deleting many images doesn't
+ * mean shifting the array for each one. Until then an image's index
+ * is only its slot in the array: use ImageIndex() for its position.
+ *
+ * Shuffling is a Fisher-Yates shuffle of sImages, done lazily:
+ * position k gets a random image from k on swapped into it, and
+ * never changes after that. So only the first few positions need
+ * settling before the first image can be shown; NthImage settles
+ * positions as they're asked for, and the rest are done in the
+ * background a chunk at a time. The list is relinked around every
+ * swap, so it's always a whole list, just not fully shuffled yet.
+ *
  * List items are freed with FreePhoImage()
  */
 
 #include "pho.h"
 #include <stdlib.h>
 
+static PhoImage** sImages = 0;
+static int sNumImages = 0;       /* images in the list */
+static int sImagesUsed = 0;      /* slots in sImages, counting holes */
+static int sImagesAlloced = 0;
+static int sFirstGap = 0;        /* lowest hole, if there are any */
+
+/* Settle this many positions past any that are asked for,
+ * so the prefetcher's next image is settled too.
+ */
+#define SHUFFLE_AHEAD 8
+/* Positions settled per idle call while shuffling in the background */
+#define SHUFFLE_CHUNK 16384
+
+static GRand* sShuffleRand = 0;  /* non-0 while a shuffle is unfinished */
+static int sShuffled = 0;        /* positions before this are settled */
+static guint sShuffleIdle = 0;
+
+static void StopShuffle()
+{
+    if (sShuffleIdle)
+        g_source_remove(sShuffleIdle);
+    sShuffleIdle = 0;
+    if (sShuffleRand)
+        g_rand_free(sShuffleRand);
+    sShuffleRand = 0;
+    sShuffled = 0;
+}
+
+/* Squeeze the holes left by DeleteItem out of sImages */
+static void CloseGaps()
+{
+    int from, to;
+    int shuffled = sShuffled;
+
+    if (sImagesUsed == sNumImages)
+        return;
+
+    for (from = to = sFirstGap; from < sImagesUsed; ++from) {
+        if (from == sShuffled)
+            shuffled = to;
+        if (!sImages[from])
+            continue;
+        sImages[to] = sImages[from];
+        sImages[to]->index = to;
+        ++to;
+    }
+    if (sShuffled >= sImagesUsed)
+        shuffled = to;
+
+    sImagesUsed = sNumImages;
+    sShuffled = shuffled;
+}
+
+/* Fix the list links on both sides of position i */
+static void RelinkAround(int i)
+{
+    int prev = (i + sNumImages - 1) % sNumImages;
+    int next = (i + 1) % sNumImages;
+
+    sImages[i]->index = i;
+    sImages[prev]->next = sImages[i];
+    sImages[i]->prev = sImages[prev];
+    sImages[i]->next = sImages[next];
+    sImages[next]->prev = sImages[i];
+}
+
+/* Settle every position up to and including n */
+static void ShuffleThrough(int n)
+{
+    if (!sShuffleRand)
+        return;
+    CloseGaps();
+    if (sNumImages < 2) {
+        StopShuffle();
+        return;
+    }
+
+    /* The last position is settled when the one before it is */
+    if (n > sNumImages - 2)
+        n = sNumImages - 2;
+    for ( ; sShuffled <= n; ++sShuffled) {
+        int j = g_rand_int_range(sShuffleRand, sShuffled, sNumImages);
+        if (j != sShuffled) {
+            PhoImage* tmp = sImages[j];
+            sImages[j] = sImages[sShuffled];
+            sImages[sShuffled] = tmp;
+            RelinkAround(sShuffled);
+            RelinkAround(j);
+        }
+    }
+    gFirstImage = sImages[0];
+
+    if (sShuffled >= sNumImages - 1) {
+        if (gDebug)
+            printf("Finished shuffling %d images\n", sNumImages);
+        StopShuffle();
+    }
+}
+
+static gboolean ShuffleIdle(gpointer data)
+{
+    guint idle = sShuffleIdle;
+
+    sShuffleIdle = 0;    /* so finishing doesn't remove this source */
+    ShuffleThrough(sShuffled + SHUFFLE_CHUNK - 1);
+    if (!sShuffleRand)
+        return FALSE;
+    sShuffleIdle = idle;
+    return TRUE;
+}
+
+/* Randomize the image list, in an order that depends only on seed
+ * and the number of images. Does not change gCurImage.
+ */
+void ShuffleImages(guint32 seed)
+{
+    StopShuffle();
+    CloseGaps();
+    if (gDebug)
+        printf("Randomizing order of %d images with seed %u\n",
+               sNumImages, seed);
+    if (sNumImages < 2)
+        return;
+
+    sShuffleRand = g_rand_new_with_seed(seed);
+    ShuffleThrough(SHUFFLE_AHEAD);
+    if (sShuffleRand)
+        sShuffleIdle = g_idle_add_full(G_PRIORITY_LOW, ShuffleIdle, 0, 0);
+}
+
+int CountImages()
+{
+    return sNumImages;
+}
+
+/* The image at index n (from 0), or 0 if there isn't one */
+PhoImage* NthImage(int n)
+{
+    if (n < 0 || n >= sNumImages)
+        return 0;
+    CloseGaps();
+    ShuffleThrough(n + SHUFFLE_AHEAD);
+    return sImages[n];
+}
+
+/* Where img is in the list, from 0 */
+int ImageIndex(PhoImage* img)
+{
+    CloseGaps();
+    return img->index;
+}
+
+/* Where to jump from index `from` so that one more NextImage (or
+ * PrevImage, if steps is negative) ends up steps images away:
+ * all but the last step, stopping short of the ends of the list
+ * so that last step still has an image to show.
+ * Returns from if there's nothing to skip.
+ */
+int SkipIndex(int from, int steps)
+{
+    if (sNumImages < 2)
+        return from;
+    if (steps > 0)
+        return MAX(from, MIN(from + steps - 1, sNumImages - 2));
+    if (steps < 0)
+        return MIN(from, MAX(from + steps + 1, 1));
+    return from;
+}
+
 /* This routine exists to keep track of any allocated memory
  * existing in the PhoImage structure.
  */
 static void FreePhoImage(PhoImage* img)
 {
+    PrefetchForget(img);
+    CacheForget(img);
     if (img->comment) free(img->comment);
+    if (img->exifDate) free(img->exifDate);
     free(img);
 }
 
@@ -88,6 +279,12 @@ void DeleteItem(PhoImage* item)
         item->prev->next = item->next;
     }
 
+    /* Leave a hole in the array, for CloseGaps() */
+    sImages[item->index] = 0;
+    if (sImagesUsed == sNumImages || item->index < sFirstGap)
+        sFirstGap = item->index;
+    --sNumImages;
+
     /* It's disconnected.  Free all the memory */
     FreePhoImage(item);
 
@@ -106,6 +303,20 @@ void AppendItem(PhoImage* item)
     if (!item)
         return;
 
+    if (sImagesUsed >= sImagesAlloced) {
+        int alloced = (sImagesAlloced ? sImagesAlloced * 2 : 256);
+        PhoImage** more = realloc(sImages, alloced * sizeof (PhoImage*));
+        if (!more) {
+            fprintf(stderr, "Out of memory!\n");
+            exit(1);
+        }
+        sImages = more;
+        sImagesAlloced = alloced;
+    }
+    item->index = sImagesUsed;
+    sImages[sImagesUsed++] = item;
+    ++sNumImages;
+
     /* Is the list empty? */
     if (gFirstImage == 0) {
         gFirstImage = item;
@@ -138,5 +349,7 @@ void ClearImageList()
     } while (img && img != gFirstImage);
 
     gCurImage = gFirstImage = 0;
+    sNumImages = sImagesUsed = 0;
+    StopShuffle();
 }
 
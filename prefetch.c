@@ -0,0 +1,367 @@
+/* -*- Mode: C; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+/*
+ * prefetch.c: decode, scale and rotate the images on either side of
+ * the current one in a worker thread, and put them in the image cache,
+ * so that going to the next or previous image doesn't have to wait
+ * for the decoder. With -M, also decode the current image at full
+ * resolution, so zooming in on it doesn't have to wait either.
+ *
+ * Copyright 2026 by Akkana Peck.
+ * You are free to use or modify this code under the Gnu Public License.
+ */
+
+/* Only gdk-pixbuf calls happen in the worker: no gtk/gdk drawing,
+ * no jhead (which keeps everything in globals), and no PhoImage
+ * fields, since the main thread may change those at any time.
+ * Everything the worker needs is copied into the PrefetchJob.
+ *
+ * A job belongs to the main thread once its PrefetchDone idle
+ * callback has run (job->delivered). Until then, the main thread
+ * may only look at it while holding sLock.
+ */
+
+#include "pho.h"
+#include "exif/phoexif.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+
+typedef struct PrefetchJob_s {
+    PhoImage* img;       /* only for comparing, never dereferenced */
+    char* filename;
+    int wantRot;         /* rotation asked for, or -1 for EXIF's */
+    int master;          /* full resolution, unscaled and unrotated */
+    PhoScaleParams params;
+
+    /* Protected by sLock */
+    int cancelled;
+    int started;
+    int finished;
+
+    /* Filled in by the worker */
+    GdkPixbuf* pixbuf;
+    int rot;
+    int trueWidth, trueHeight;
+
+    /* Main thread only */
+    int delivered;
+    struct PrefetchJob_s* next;
+} PrefetchJob;
+
+/* How many threads to decode with: one for next, one for prev. */
+#define PREFETCH_THREADS 2
+
+static GThreadPool* sPool = 0;
+static int sPoolFailed = 0;
+static GMutex sLock;
+static GCond sFinishedCond;
+
+/* Every job the main thread still cares about, pending or done. */
+static PrefetchJob* sJobs = 0;
+
+static void FreeJob(PrefetchJob* job)
+{
+    if (job->pixbuf)
+        g_object_unref(job->pixbuf);
+    free(job);
+}
+
+/* Take a job off sJobs and make sure it gets freed,
+ * either now or when the worker is finished with it.
+ */
+static void DropJob(PrefetchJob* job)
+{
+    PrefetchJob** jp;
+    for (jp = &sJobs; *jp; jp = &((*jp)->next))
+        if (*jp == job) {
+            *jp = job->next;
+            break;
+        }
+
+    g_mutex_lock(&sLock);
+    job->cancelled = 1;
+    g_mutex_unlock(&sLock);
+
+    /* If PrefetchDone has already run, nobody else will free it */
+    if (job->delivered)
+        FreeJob(job);
+}
+
+/* Move a finished job's pixbuf into the cache. */
+static void DeliverJob(PrefetchJob* job)
+{
+    if (job->pixbuf) {
+        if (gDebug)
+            printf("Prefetched %s%s: %dx%d, rotation %d\n", job->filename,
+                   job->master ? " master" : "",
+                   gdk_pixbuf_get_width(job->pixbuf),
+                   gdk_pixbuf_get_height(job->pixbuf), job->rot);
+        if (job->master)
+            CacheAddMaster(job->img, job->pixbuf);
+        else
+            CacheAdd(job->img, job->pixbuf, job->rot,
+                     job->trueWidth, job->trueHeight);
+    }
+    /* If it didn't load, leave it for the normal path to complain about */
+    else if (gDebug)
+        printf("Prefetch of %s failed\n", job->filename);
+
+    DropJob(job);
+}
+
+/* Runs on the main thread once the worker is finished with a job. */
+static gboolean PrefetchDone(gpointer data)
+{
+    PrefetchJob* job = (PrefetchJob*)data;
+
+    job->delivered = 1;
+    if (job->cancelled)          /* already off sJobs */
+        FreeJob(job);
+    else
+        DeliverJob(job);
+
+    return FALSE;
+}
+
+/* Do the same thing LoadImageAndRotate would, without touching globals. */
+static void DecodeJob(PrefetchJob* job)
+{
+    GError* err = 0;
+    GdkPixbuf* pix;
+    int trueWidth, trueHeight, width, height, new_width, new_height;
+    gint64 startTime = g_get_monotonic_time();
+
+    pix = LoadPixbufForDisplay(job->filename,
+                               job->master ? 0 : &job->params, job->wantRot,
+                               &trueWidth, &trueHeight, &err);
+    if (!pix) {
+        if (err)
+            g_error_free(err);
+        return;
+    }
+
+    /* A master is just the image as it comes out of the decoder,
+     * still marked if it needs flipping.
+     */
+    if (job->master) {
+        job->rot = 0;
+        job->trueWidth = trueWidth;
+        job->trueHeight = trueHeight;
+        job->pixbuf = pix;
+        if (gDebug)
+            printf("Prefetch thread: %s master took %ld msec\n",
+                   job->filename,
+                   (long)((g_get_monotonic_time() - startTime) / 1000));
+        return;
+    }
+    width = gdk_pixbuf_get_width(pix);
+    height = gdk_pixbuf_get_height(pix);
+
+    if (job->wantRot >= 0)
+        job->rot = job->wantRot;
+    else {
+        const char* orient = gdk_pixbuf_get_option(pix, "orientation");
+        job->rot = (orient ? ExifOrientationRot(atoi(orient)) : 0);
+    }
+
+    CalcScaledSize(&job->params, trueWidth, trueHeight, width, height,
+                   job->rot, &new_width, &new_height);
+
+    /* That one will be tiled, which has to happen on the main thread */
+    if (TooBigToScale(&job->params, new_width, new_height, width, height)) {
+        g_object_unref(pix);
+        return;
+    }
+
+    /* Scale and rotate in one pass if it needs both */
+    if (new_width != width || new_height != height) {
+        GdkPixbuf* scaled = ScaleRotatePixbuf(pix, new_width, new_height,
+                                              job->rot);
+        g_object_unref(pix);
+        if (!scaled)
+            return;
+        pix = scaled;
+    }
+    else if (job->rot != 0 || IsMirrored(pix)) {
+        GdkPixbuf* rotated = RotatePixbuf(pix, job->rot);
+        g_object_unref(pix);
+        if (!rotated)
+            return;
+        pix = rotated;
+    }
+
+    if (job->rot % 180 != 0) {
+        job->trueWidth = trueHeight;
+        job->trueHeight = trueWidth;
+    }
+    else {
+        job->trueWidth = trueWidth;
+        job->trueHeight = trueHeight;
+    }
+    job->pixbuf = pix;
+
+    if (gDebug)
+        printf("Prefetch thread: %s took %ld msec\n", job->filename,
+               (long)((g_get_monotonic_time() - startTime) / 1000));
+}
+
+/* The worker thread's entry point */
+static void PrefetchWork(gpointer data, gpointer user_data)
+{
+    PrefetchJob* job = (PrefetchJob*)data;
+    int cancelled;
+
+    g_mutex_lock(&sLock);
+    cancelled = job->cancelled;
+    if (!cancelled)
+        job->started = 1;
+    g_mutex_unlock(&sLock);
+
+    if (!cancelled)
+        DecodeJob(job);
+
+    g_mutex_lock(&sLock);
+    job->finished = 1;
+    g_cond_broadcast(&sFinishedCond);
+    g_mutex_unlock(&sLock);
+
+    g_idle_add(PrefetchDone, job);
+}
+
+static PrefetchJob* FindJob(PhoImage* img, int master)
+{
+    PrefetchJob* job;
+    for (job = sJobs; job; job = job->next)
+        if (job->img == img && job->master == master)
+            return job;
+    return 0;
+}
+
+static void QueueJob(PhoImage* img, PhoScaleParams* params, int master)
+{
+    PrefetchJob* job;
+    int wantRot = (master ? 0 : (img->trueWidth == 0 ? -1 : img->curRot));
+
+    job = FindJob(img, master);
+    if (job) {
+        if (master)
+            return;           /* masters don't depend on params */
+        if (job->wantRot == wantRot && SameScaleParams(&job->params, params))
+            return;           /* already on it */
+        DropJob(job);
+    }
+
+    if (master ? CacheHasMaster(img) : CacheHas(img, wantRot, params))
+        return;
+
+    job = calloc(1, sizeof (PrefetchJob));
+    if (!job)
+        return;
+    job->img = img;
+    job->filename = img->filename;   /* never freed while img exists */
+    job->wantRot = wantRot;
+    job->master = master;
+    job->params = *params;
+
+    if (!g_thread_pool_push(sPool, job, 0)) {
+        free(job);
+        return;
+    }
+    job->next = sJobs;
+    sJobs = job;
+    if (gDebug)
+        printf("Prefetching %s%s\n", img->filename, master ? " master" : "");
+}
+
+void PrefetchNeighbors()
+{
+    PhoScaleParams params;
+    PhoImage* next;
+    PhoImage* prev;
+    PrefetchJob* job;
+    PrefetchJob* nextJob;
+
+    if (!gCurImage || sPoolFailed || gCacheMegabytes <= 0)
+        return;
+
+    if (!sPool) {
+        GError* err = 0;
+        sPool = g_thread_pool_new(PrefetchWork, 0, PREFETCH_THREADS,
+                                  FALSE, &err);
+        if (!sPool) {
+            fprintf(stderr, "Couldn't start prefetch thread: %s\n",
+                    err ? err->message : "unknown error");
+            if (err)
+                g_error_free(err);
+            sPoolFailed = 1;
+            return;
+        }
+    }
+
+    next = (gCurImage->next != gFirstImage ? gCurImage->next : 0);
+    prev = (gCurImage != gFirstImage ? gCurImage->prev : 0);
+
+    GetScaleParams(&params);
+
+    /* Anything that isn't a neighbor any more is just wasting memory */
+    for (job = sJobs; job; job = nextJob) {
+        nextJob = job->next;
+        if (job->master ? (job->img != gCurImage)
+                        : (job->img != next && job->img != prev))
+            DropJob(job);
+    }
+
+    /* Next is more likely, so ask for it first */
+    if (next)
+        QueueJob(next, &params, 0);
+    if (prev && prev != next)
+        QueueJob(prev, &params, 0);
+
+    /* Zooming in is less likely than moving on, so the master is last,
+     * and only if the current image isn't already at full resolution.
+     */
+    if (gKeepMasters && gCurImage->trueWidth > 0
+        && (gCurImage->curWidth < gCurImage->trueWidth
+            || gCurImage->curHeight < gCurImage->trueHeight))
+        QueueJob(gCurImage, &params, 1);
+}
+
+static void WaitForJob(PrefetchJob* job)
+{
+    int finished;
+
+    /* If the worker is already decoding it, waiting is faster than
+     * starting over. If it hasn't started, don't bother.
+     */
+    g_mutex_lock(&sLock);
+    while (job->started && !job->finished)
+        g_cond_wait(&sFinishedCond, &sLock);
+    finished = job->finished;
+    g_mutex_unlock(&sLock);
+
+    if (finished)
+        DeliverJob(job);
+    else
+        DropJob(job);
+}
+
+void PrefetchWait(PhoImage* img)
+{
+    PrefetchJob* job = FindJob(img, 0);
+    if (job)
+        WaitForJob(job);
+}
+
+void PrefetchWaitMaster(PhoImage* img)
+{
+    PrefetchJob* job = FindJob(img, 1);
+    if (job)
+        WaitForJob(job);
+}
+
+void PrefetchForget(PhoImage* img)
+{
+    PrefetchJob* job;
+    while ((job = FindJob(img, 0)) != 0 || (job = FindJob(img, 1)) != 0)
+        DropJob(job);
+}
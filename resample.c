@@ -0,0 +1,366 @@
+/* -*- Mode: C; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+/*
+ * resample.c: pho's own downscalers, for when gdk-pixbuf's bilinear
+ * filter is too slow, or too jaggy for a big reduction.
+ *
+ * Copyright 2026 by Akkana Peck.
+ * You are free to use or modify this code under the Gnu Public License.
+ */
+
+/* Both filters are separable, and described the same way: for each
+ * output column (or row), which source pixels go into it and with
+ * what weights. For a reduction of 2 or more it's an area average:
+ * every source pixel the output pixel covers, weighted by how much of
+ * it is covered. Less than that, it's a Lanczos-3 window stretched
+ * by the reduction, which stays sharp where an area average would
+ * look soft.
+ *
+ * Output rows are done a chunk at a time: each source row the chunk
+ * needs is filtered horizontally once, into floats, and then each
+ * output row is a weighted sum of those rows. With SSE2, a 4-channel
+ * pixel is one vector in the horizontal pass, and the vertical sums
+ * go four floats at a time; otherwise it's plain C, with 3 channels
+ * (the usual JPEG) unrolled.
+ *
+ * With alpha, colors are premultiplied by alpha as they're filtered,
+ * and divided back out as each row is stored, the way gdk-pixbuf
+ * does it, so transparent pixels don't bleed their color into
+ * the edges of opaque ones.
+ */
+
+#include "pho.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+/* Which scaler ScaleRotatePixbuf shrinks with */
+int gScaleFilter = PHO_FILTER_GDK;
+
+/* Output rows per chunk, which bounds the filtered rows kept around */
+#define CHUNK_ROWS 16
+
+#define LANCZOS_LOBES 3
+
+typedef struct {
+    int start, n;      /* first source pixel, and how many */
+    int offset;        /* where its weights start */
+} Contrib;
+
+typedef struct {
+    Contrib* contribs;
+    float* weights;
+} FilterTable;
+
+struct Resampler_s {
+    GdkPixbuf* src;
+    int width, height, nchannels;
+    int hasAlpha;
+    FilterTable horiz, vert;
+};
+
+static double Sinc(double x)
+{
+    if (x == 0.)
+        return 1.;
+    x *= G_PI;
+    return sin(x) / x;
+}
+
+static double Lanczos(double x)
+{
+    if (x <= -LANCZOS_LOBES || x >= LANCZOS_LOBES)
+        return 0.;
+    return Sinc(x) * Sinc(x / LANCZOS_LOBES);
+}
+
+/* Fill in the source pixels and weights for shrinking srcSize pixels
+ * to dstSize. Returns 0 if it's out of memory.
+ */
+static int MakeFilterTable(FilterTable* t, int srcSize, int dstSize)
+{
+    double ratio = (double)srcSize / dstSize;
+    int area = (ratio >= 2.);
+    double support = (area ? ratio / 2. + 1. : LANCZOS_LOBES * ratio);
+    int maxN = (int)ceil(2. * support) + 1;
+    int i, j;
+
+    t->contribs = malloc(dstSize * sizeof (Contrib));
+    t->weights = malloc((long)dstSize * maxN * sizeof (float));
+    if (!t->contribs || !t->weights) {
+        free(t->contribs);
+        free(t->weights);
+        t->contribs = 0;
+        t->weights = 0;
+        return 0;
+    }
+
+    for (i = 0; i < dstSize; ++i) {
+        Contrib* c = t->contribs + i;
+        float* w = t->weights + (long)i * maxN;
+        double left = i * ratio, right = (i + 1) * ratio;
+        double center = left + ratio / 2.;
+        double total = 0.;
+        int first, last;
+
+        first = (int)floor(center - support);
+        last = (int)ceil(center + support);
+        if (first < 0)
+            first = 0;
+        if (last > srcSize - 1)
+            last = srcSize - 1;
+        if (last - first + 1 > maxN)
+            last = first + maxN - 1;
+
+        for (j = first; j <= last; ++j) {
+            double weight;
+            if (area)
+                weight = MIN(j + 1., right) - MAX((double)j, left);
+            else
+                weight = Lanczos((j + .5 - center) / ratio);
+            if (weight < 0. && area)
+                weight = 0.;
+            w[j - first] = (float)weight;
+            total += weight;
+        }
+
+        /* Trim the zero weights off the ends */
+        while (first < last && w[0] == 0.f) {
+            memmove(w, w + 1, (last - first) * sizeof (float));
+            ++first;
+        }
+        while (last > first && w[last - first] == 0.f)
+            --last;
+
+        c->start = first;
+        c->n = last - first + 1;
+        c->offset = i * maxN;
+        if (total != 0.)
+            for (j = 0; j < c->n; ++j)
+                w[j] = (float)(w[j] / total);
+    }
+    return 1;
+}
+
+static void FreeFilterTable(FilterTable* t)
+{
+    free(t->contribs);
+    free(t->weights);
+}
+
+Resampler* NewResampler(GdkPixbuf* src, int width, int height)
+{
+    Resampler* r;
+    int srcWidth = gdk_pixbuf_get_width(src);
+    int srcHeight = gdk_pixbuf_get_height(src);
+
+    if (gScaleFilter != PHO_FILTER_PHO
+        || width > srcWidth || height > srcHeight
+        || (width == srcWidth && height == srcHeight)
+        || width < 1 || height < 1)
+        return 0;
+
+    r = calloc(1, sizeof (Resampler));
+    if (!r)
+        return 0;
+    r->src = src;
+    r->width = width;
+    r->height = height;
+    r->nchannels = gdk_pixbuf_get_n_channels(src);
+    r->hasAlpha = gdk_pixbuf_get_has_alpha(src);
+    if (!MakeFilterTable(&r->horiz, srcWidth, width)
+        || !MakeFilterTable(&r->vert, srcHeight, height)) {
+        FreeResampler(r);
+        return 0;
+    }
+    return r;
+}
+
+void FreeResampler(Resampler* r)
+{
+    FreeFilterTable(&r->horiz);
+    FreeFilterTable(&r->vert);
+    free(r);
+}
+
+/* Filter one source row horizontally into width * nchannels floats */
+static void FilterRow(Resampler* r, const guchar* src, float* out)
+{
+    int nchannels = r->nchannels;
+    int x, k, i;
+
+    for (x = 0; x < r->width; ++x) {
+        const Contrib* c = r->horiz.contribs + x;
+        const float* w = r->horiz.weights + c->offset;
+        const guchar* p = src + c->start * nchannels;
+
+#ifdef __SSE2__
+        if (nchannels == 4) {
+            __m128i zero = _mm_setzero_si128();
+            __m128 acc = _mm_setzero_ps();
+            for (k = 0; k < c->n; ++k, p += 4) {
+                int pixel;
+                __m128i v;
+                __m128 weight;
+                memcpy(&pixel, p, 4);
+                v = _mm_unpacklo_epi8(_mm_cvtsi32_si128(pixel), zero);
+                v = _mm_unpacklo_epi16(v, zero);
+                if (r->hasAlpha) {
+                    float wa = w[k] * p[3] * (1.f / 255.f);
+                    weight = _mm_set_ps(w[k], wa, wa, wa);
+                }
+                else
+                    weight = _mm_set1_ps(w[k]);
+                acc = _mm_add_ps(acc, _mm_mul_ps(_mm_cvtepi32_ps(v), weight));
+            }
+            _mm_storeu_ps(out + x * 4, acc);
+            continue;
+        }
+#endif
+        if (nchannels == 3) {
+            float red = 0.f, green = 0.f, blue = 0.f;
+            for (k = 0; k < c->n; ++k, p += 3) {
+                red += p[0] * w[k];
+                green += p[1] * w[k];
+                blue += p[2] * w[k];
+            }
+            out[x * 3] = red;
+            out[x * 3 + 1] = green;
+            out[x * 3 + 2] = blue;
+            continue;
+        }
+        if (r->hasAlpha) {
+            float red = 0.f, green = 0.f, blue = 0.f, alpha = 0.f;
+            for (k = 0; k < c->n; ++k, p += 4) {
+                float wa = w[k] * p[3] * (1.f / 255.f);
+                red += p[0] * wa;
+                green += p[1] * wa;
+                blue += p[2] * wa;
+                alpha += p[3] * w[k];
+            }
+            out[x * 4] = red;
+            out[x * 4 + 1] = green;
+            out[x * 4 + 2] = blue;
+            out[x * 4 + 3] = alpha;
+            continue;
+        }
+
+        /* Anything else isn't worth a fast path */
+        for (i = 0; i < nchannels; ++i) {
+            float sum = 0.f;
+            for (k = 0; k < c->n; ++k)
+                sum += p[k * nchannels + i] * w[k];
+            out[x * nchannels + i] = sum;
+        }
+    }
+}
+
+/* acc[i] += weight * row[i] for n floats */
+static void AddWeightedRow(float* acc, const float* row, float weight, int n)
+{
+    int i = 0;
+
+#ifdef __SSE2__
+    __m128 w = _mm_set1_ps(weight);
+    for ( ; i + 4 <= n; i += 4)
+        _mm_storeu_ps(acc + i,
+                      _mm_add_ps(_mm_loadu_ps(acc + i),
+                                 _mm_mul_ps(_mm_loadu_ps(row + i), w)));
+#endif
+    for ( ; i < n; ++i)
+        acc[i] += weight * row[i];
+}
+
+static guchar ToByte(float v)
+{
+    v += .5f;
+    return (v <= 0.f ? 0 : (v >= 255.f ? 255 : (guchar)v));
+}
+
+/* Store n floats as bytes, taking premultiplied alpha back out */
+static void StoreRow(guchar* dst, const float* acc, int n, int hasAlpha)
+{
+    int i;
+
+    if (hasAlpha) {
+        for (i = 0; i + 4 <= n; i += 4) {
+            float alpha = acc[i + 3];
+            float scale = (alpha > 0.f ? 255.f / alpha : 0.f);
+            dst[i] = ToByte(acc[i] * scale);
+            dst[i + 1] = ToByte(acc[i + 1] * scale);
+            dst[i + 2] = ToByte(acc[i + 2] * scale);
+            dst[i + 3] = ToByte(alpha);
+        }
+        return;
+    }
+
+    for (i = 0; i < n; ++i)
+        dst[i] = ToByte(acc[i]);
+}
+
+int ResampleRows(Resampler* r, guchar* dst, int dstrowstride,
+                 int firstRow, int endRow)
+{
+    const guchar* srcpixels = gdk_pixbuf_get_pixels(r->src);
+    int srcrowstride = gdk_pixbuf_get_rowstride(r->src);
+    int rowFloats = r->width * r->nchannels;
+    float* rows = 0;
+    float* acc;
+    int rowsAlloced = 0;
+    int y, chunk;
+
+    acc = malloc(rowFloats * sizeof (float));
+    if (!acc)
+        return 0;
+
+    for (chunk = firstRow; chunk < endRow; chunk += CHUNK_ROWS) {
+        int chunkEnd = MIN(endRow, chunk + CHUNK_ROWS);
+        int srcFirst = r->vert.contribs[chunk].start;
+        int srcEnd = srcFirst;
+        int k;
+
+        for (y = chunk; y < chunkEnd; ++y) {
+            const Contrib* c = r->vert.contribs + y;
+            srcEnd = MAX(srcEnd, c->start + c->n);
+        }
+
+        if (srcEnd - srcFirst > rowsAlloced) {
+            float* more = realloc(rows, (long)(srcEnd - srcFirst)
+                                        * rowFloats * sizeof (float));
+            if (!more) {
+                free(rows);
+                free(acc);
+                return 0;
+            }
+            rows = more;
+            rowsAlloced = srcEnd - srcFirst;
+        }
+
+        for (k = srcFirst; k < srcEnd; ++k)
+            FilterRow(r, srcpixels + (long)k * srcrowstride,
+                      rows + (long)(k - srcFirst) * rowFloats);
+
+        for (y = chunk; y < chunkEnd; ++y) {
+            const Contrib* c = r->vert.contribs + y;
+            const float* w = r->vert.weights + c->offset;
+
+            memset(acc, 0, rowFloats * sizeof (float));
+            for (k = 0; k < c->n; ++k)
+                AddWeightedRow(acc,
+                               rows + (long)(c->start + k - srcFirst)
+                                      * rowFloats,
+                               w[k], rowFloats);
+            StoreRow(dst + (long)(y - firstRow) * dstrowstride, acc,
+                     rowFloats, r->hasAlpha);
+        }
+    }
+
+    free(rows);
+    free(acc);
+    return 1;
+}
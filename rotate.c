@@ -0,0 +1,452 @@
+/* -*- Mode: C; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+/*
+ * rotate.c: rotating pixbufs by multiples of 90 degrees,
+ * and flipping the ones EXIF says are mirror images.
+ *
+ * Copyright 2026 by Akkana Peck.
+ * You are free to use or modify this code under the Gnu Public License.
+ */
+
+/* Every rotation is described the same way: where in the source the
+ * first output pixel comes from, and how far to step in the source
+ * for each step right (stepX) or down (stepY) in the output.
+ * So the output is always written in order, a row at a time.
+ *
+ * For 90 and 270, stepX is a whole source row, so copying one output
+ * row straight through would touch a different cache line for every
+ * pixel. Instead the output is done in BLOCK x BLOCK squares: the
+ * BLOCK source rows a square reads from stay in cache until it's done.
+ *
+ * The per-pixel copy is picked once per rotation, not once per
+ * pixel, with plain fixed-size versions for 3 and 4 channels that
+ * the compiler can turn into a few moves.
+ *
+ * Since the output goes a row at a time, it's easy to split into
+ * bands of rows for RunInBands to do on several processors.
+ *
+ * A mirror image (EXIF orientations 2, 4, 5 and 7) is just a different
+ * origin and stepX in the source, so flipping it costs nothing extra
+ * when it's done as part of a rotation, and it's never done on its own
+ * unless the image doesn't need rotating at all. Decoders don't flip,
+ * so a pixbuf that still needs flipping is marked with MarkMirrored(),
+ * and the next RotatePixbuf or ScaleRotatePixbuf of it flips it.
+ */
+
+#include "pho.h"
+#include "exif/phoexif.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define BLOCK 16
+
+typedef void (*CopyPixelsFunc)(guchar* dst, const guchar* src, int n,
+                               long srcStep, int nchannels);
+
+static void CopyPixels3(guchar* dst, const guchar* src, int n,
+                        long srcStep, int nchannels)
+{
+    while (n-- > 0) {
+        dst[0] = src[0];
+        dst[1] = src[1];
+        dst[2] = src[2];
+        dst += 3;
+        src += srcStep;
+    }
+}
+
+static void CopyPixels4(guchar* dst, const guchar* src, int n,
+                        long srcStep, int nchannels)
+{
+    while (n-- > 0) {
+        memcpy(dst, src, 4);
+        dst += 4;
+        src += srcStep;
+    }
+}
+
+static void CopyPixelsN(guchar* dst, const guchar* src, int n,
+                        long srcStep, int nchannels)
+{
+    while (n-- > 0) {
+        memcpy(dst, src, nchannels);
+        dst += nchannels;
+        src += srcStep;
+    }
+}
+
+typedef struct {
+    const guchar* origin;
+    long stepX, stepY;
+    guchar* newpixels;
+    int newrowstride, newWidth, nchannels;
+    int blocked;
+    CopyPixelsFunc copy;
+} RotateJob;
+
+/* Write output rows firstRow up to endRow: one band's worth. */
+static void RotateRows(gpointer data, int firstRow, int endRow)
+{
+    RotateJob* job = (RotateJob*)data;
+    int nchannels = job->nchannels;
+    int bx, by, y;
+
+    /* For 180, both sides go a row at a time anyway: no need to block */
+    if (!job->blocked) {
+        for (y = firstRow; y < endRow; ++y)
+            job->copy(job->newpixels + (long)y * job->newrowstride,
+                      job->origin + y * job->stepY,
+                      job->newWidth, job->stepX, nchannels);
+        return;
+    }
+
+    for (by = firstRow; by < endRow; by += BLOCK) {
+        int blockHeight = MIN(BLOCK, endRow - by);
+        for (bx = 0; bx < job->newWidth; bx += BLOCK) {
+            int blockWidth = MIN(BLOCK, job->newWidth - bx);
+            for (y = by; y < by + blockHeight; ++y)
+                job->copy(job->newpixels + (long)y * job->newrowstride
+                                         + bx * nchannels,
+                          job->origin + y * job->stepY + bx * job->stepX,
+                          blockWidth, job->stepX, nchannels);
+        }
+    }
+}
+
+/* Fill in where job starts reading and how it steps through a
+ * width x height block of pixels at oldpixels, to flip it left to
+ * right if mirror is set, then rotate it by degrees.
+ * Returns 0 for a rotation it doesn't know how to do.
+ */
+static int SetUpRotation(RotateJob* job, const guchar* oldpixels,
+                         int oldrowstride, int width, int height,
+                         int nchannels, int degrees, int mirror)
+{
+    /* Where the (possibly flipped) source starts, and how to step
+     * one pixel right (sx) or down (sy) in it.
+     */
+    const guchar* start = oldpixels;
+    long sx = nchannels;
+    long sy = oldrowstride;
+
+    if (mirror) {
+        start += (long)(width - 1) * nchannels;
+        sx = -nchannels;
+    }
+
+    switch (degrees)
+    {
+      case 0:
+        job->newWidth = width;
+        job->origin = start;
+        job->stepX = sx;
+        job->stepY = sy;
+        break;
+      case 90:
+        /* new (x, y) = old (y, height-1 - x) */
+        job->newWidth = height;
+        job->origin = start + (height - 1) * sy;
+        job->stepX = -sy;
+        job->stepY = sx;
+        break;
+      case 270:
+        /* new (x, y) = old (width-1 - y, x) */
+        job->newWidth = height;
+        job->origin = start + (width - 1) * sx;
+        job->stepX = sy;
+        job->stepY = -sx;
+        break;
+      case 180:
+        job->newWidth = width;
+        job->origin = start + (height - 1) * sy + (width - 1) * sx;
+        job->stepX = -sx;
+        job->stepY = -sy;
+        break;
+      default:
+        printf("Illegal rotation value!\n");
+        return 0;
+    }
+
+    job->nchannels = nchannels;
+    job->blocked = (degrees % 180 != 0);
+    if (nchannels == 3)
+        job->copy = CopyPixels3;
+    else if (nchannels == 4)
+        job->copy = CopyPixels4;
+    else
+        job->copy = CopyPixelsN;
+    return 1;
+}
+
+void MarkMirrored(GdkPixbuf* pix)
+{
+    g_object_set_data(G_OBJECT(pix), "pho-mirror", GINT_TO_POINTER(1));
+}
+
+int IsMirrored(GdkPixbuf* pix)
+{
+    return pix && g_object_get_data(G_OBJECT(pix), "pho-mirror") != 0;
+}
+
+int MarkIfMirrored(GdkPixbuf* pix)
+{
+    const char* orient = gdk_pixbuf_get_option(pix, "orientation");
+
+    if (!orient || !ExifOrientationMirror(atoi(orient)))
+        return 0;
+    MarkMirrored(pix);
+    return 1;
+}
+
+void RotatePixels(const guchar* src, int srcrowstride, int width, int height,
+                  int nchannels, int degrees, int mirror,
+                  guchar* dst, int dstrowstride)
+{
+    RotateJob job;
+
+    if (!SetUpRotation(&job, src, srcrowstride, width, height,
+                       nchannels, degrees, mirror))
+        return;
+    job.newpixels = dst;
+    job.newrowstride = dstrowstride;
+    RotateRows(&job, 0, (degrees % 180 == 0 ? height : width));
+}
+
+GdkPixbuf* RotatePixbuf(GdkPixbuf* src, int degrees)
+{
+    int oldWidth, oldHeight, newWidth, newHeight;
+    int mirror = IsMirrored(src);
+    RotateJob job;
+    GdkPixbuf* newImage;
+    gint64 startTime = g_get_monotonic_time();
+
+    oldWidth = gdk_pixbuf_get_width(src);
+    oldHeight = gdk_pixbuf_get_height(src);
+    if (!SetUpRotation(&job, gdk_pixbuf_get_pixels(src),
+                       gdk_pixbuf_get_rowstride(src), oldWidth, oldHeight,
+                       gdk_pixbuf_get_n_channels(src), degrees, mirror))
+        return 0;
+    newWidth = job.newWidth;
+    newHeight = (degrees % 180 == 0 ? oldHeight : oldWidth);
+
+    newImage = gdk_pixbuf_new(GDK_COLORSPACE_RGB,
+                              gdk_pixbuf_get_has_alpha(src),
+                              gdk_pixbuf_get_bits_per_sample(src),
+                              newWidth, newHeight);
+    if (!newImage) return 0;
+    job.newpixels = gdk_pixbuf_get_pixels(newImage);
+    job.newrowstride = gdk_pixbuf_get_rowstride(newImage);
+
+    /* Keep bands a whole number of blocks high */
+    RunInBands(RotateRows, &job, newHeight, BLOCK);
+
+    if (gDebug)
+        printf("Rotated %dx%d by %d%s in %ld msec\n", oldWidth, oldHeight,
+               degrees, mirror ? " mirrored" : "",
+               (long)((g_get_monotonic_time() - startTime) / 1000));
+
+    return newImage;
+}
+
+/* Rotating in place: 180 just swaps pixels from the two ends,
+ * and 90 or 270 is a transpose followed by a flip. A pixbuf can't
+ * change shape, so for those the result is a new pixbuf around the
+ * same memory, holding a reference to the old one to keep it alive.
+ *
+ * The transpose follows the permutation's cycles, keeping a bit per
+ * pixel for the ones already moved. That jumps all over memory, so
+ * it's much slower than RotatePixbuf: it's only worth it for images
+ * big enough that a second copy might not fit.
+ */
+#define IN_PLACE_MIN_BYTES (64L * 1024 * 1024)
+
+/* Enough for any pixbuf pho will ever see */
+#define MAX_CHANNELS 8
+
+typedef struct {
+    guchar* pixels;
+    int rowstride, width, height, nchannels;
+    int reverse;
+} FlipJob;
+
+static void SwapPixels(guchar* a, guchar* b, int nchannels)
+{
+    int i;
+    for (i = 0; i < nchannels; ++i) {
+        guchar tmp = a[i];
+        a[i] = b[i];
+        b[i] = tmp;
+    }
+}
+
+/* Reverse the pixels in each of rows firstRow up to endRow */
+static void FlipRows(gpointer data, int firstRow, int endRow)
+{
+    FlipJob* job = (FlipJob*)data;
+    int nchannels = job->nchannels;
+    int x, y;
+
+    for (y = firstRow; y < endRow; ++y) {
+        guchar* row = job->pixels + (long)y * job->rowstride;
+        for (x = 0; x < job->width / 2; ++x)
+            SwapPixels(row + x * nchannels,
+                       row + (job->width - 1 - x) * nchannels, nchannels);
+    }
+}
+
+/* Swap each of rows firstRow up to endRow (all in the top half)
+ * with its opposite number in the bottom half, reversing both
+ * if job->reverse is set.
+ */
+static void SwapRows(gpointer data, int firstRow, int endRow)
+{
+    FlipJob* job = (FlipJob*)data;
+    int nchannels = job->nchannels;
+    int x, y;
+
+    for (y = firstRow; y < endRow; ++y) {
+        guchar* top = job->pixels + (long)y * job->rowstride;
+        guchar* bottom = job->pixels
+                         + (long)(job->height - 1 - y) * job->rowstride;
+        if (job->reverse)
+            for (x = 0; x < job->width; ++x)
+                SwapPixels(top + x * nchannels,
+                           bottom + (job->width - 1 - x) * nchannels,
+                           nchannels);
+        else
+            for (x = 0; x < job->width; ++x)
+                SwapPixels(top + x * nchannels, bottom + x * nchannels,
+                           nchannels);
+    }
+}
+
+/* Turn the image upside down, and back to front too if reverse is set */
+static void FlipVertically(FlipJob* job, int reverse)
+{
+    job->reverse = reverse;
+    RunInBands(SwapRows, job, job->height / 2, 1);
+
+    /* An odd row in the middle only has itself to swap with */
+    if (reverse && job->height % 2)
+        FlipRows(job, job->height / 2, job->height / 2 + 1);
+}
+
+/* Transpose width x height pixels with no gaps between the rows.
+ * visited has a bit per pixel, all clear.
+ */
+static void Transpose(guchar* pixels, int width, int height, int nchannels,
+                      guchar* visited)
+{
+    long n = (long)width * height;
+    guchar carry[MAX_CHANNELS], next[MAX_CHANNELS];
+    long start, i, dest;
+
+    /* The first and last pixels stay where they are */
+    for (start = 1; start < n - 1; ++start) {
+        if (visited[start >> 3] & (1 << (start & 7)))
+            continue;
+        memcpy(carry, pixels + start * nchannels, nchannels);
+        i = start;
+        do {
+            /* (x, y) goes to (y, x) */
+            dest = (i % width) * height + i / width;
+            memcpy(next, pixels + dest * nchannels, nchannels);
+            memcpy(pixels + dest * nchannels, carry, nchannels);
+            memcpy(carry, next, nchannels);
+            visited[dest >> 3] |= 1 << (dest & 7);
+            i = dest;
+        } while (i != start);
+    }
+}
+
+static void ReleaseOldPixbuf(guchar* pixels, gpointer data)
+{
+    g_object_unref(G_OBJECT(data));
+}
+
+GdkPixbuf* RotatePixbufInPlace(GdkPixbuf* pix, int degrees)
+{
+    int width = gdk_pixbuf_get_width(pix);
+    int height = gdk_pixbuf_get_height(pix);
+    int rowstride = gdk_pixbuf_get_rowstride(pix);
+    int nchannels = gdk_pixbuf_get_n_channels(pix);
+    int mirror = IsMirrored(pix);
+    guchar* pixels = gdk_pixbuf_get_pixels(pix);
+    guchar* visited = 0;
+    GdkPixbuf* rotated;
+    FlipJob job;
+    int y;
+    gint64 startTime = g_get_monotonic_time();
+
+    /* Anyone else holding it expects it to stay the way it is */
+    if (G_OBJECT(pix)->ref_count > 1)
+        return 0;
+
+    if (degrees % 180 != 0) {
+        if ((long)rowstride * height < IN_PLACE_MIN_BYTES
+            || nchannels > MAX_CHANNELS)
+            return 0;
+
+        /* Get everything that could fail out of the way first */
+        visited = calloc(((long)width * height + 7) / 8, 1);
+        if (!visited)
+            return 0;
+        rotated = gdk_pixbuf_new_from_data(pixels, GDK_COLORSPACE_RGB,
+                                           gdk_pixbuf_get_has_alpha(pix),
+                                           8, height, width,
+                                           height * nchannels,
+                                           ReleaseOldPixbuf,
+                                           g_object_ref(pix));
+        if (!rotated) {
+            g_object_unref(pix);
+            free(visited);
+            return 0;
+        }
+    }
+    else if (degrees == 0 || degrees == 180)
+        rotated = g_object_ref(pix);
+    else {
+        printf("Illegal rotation value!\n");
+        return 0;
+    }
+
+    /* The mip levels and the mirror mark were about the old pixels */
+    g_object_set_data(G_OBJECT(pix), "pho-mip", 0);
+    g_object_set_data(G_OBJECT(pix), "pho-mirror", 0);
+
+    job.pixels = pixels;
+    job.rowstride = rowstride;
+    job.width = width;
+    job.height = height;
+    job.nchannels = nchannels;
+    if (mirror)
+        RunInBands(FlipRows, &job, height, 1);
+
+    if (degrees == 180)
+        FlipVertically(&job, 1);
+    else if (degrees != 0) {
+        /* Squeeze out any padding at the ends of the rows */
+        for (y = 1; y < height; ++y)
+            memmove(pixels + (long)y * width * nchannels,
+                    pixels + (long)y * rowstride, (long)width * nchannels);
+        Transpose(pixels, width, height, nchannels, visited);
+        free(visited);
+
+        /* 90 is the transpose flipped left to right, 270 top to bottom */
+        job.rowstride = height * nchannels;
+        job.width = height;
+        job.height = width;
+        if (degrees == 90)
+            RunInBands(FlipRows, &job, job.height, 1);
+        else
+            FlipVertically(&job, 0);
+    }
+
+    if (gDebug)
+        printf("Rotated %dx%d by %d%s in place in %ld msec\n", width, height,
+               degrees, mirror ? " mirrored" : "",
+               (long)((g_get_monotonic_time() - startTime) / 1000));
+
+    return rotated;
+}
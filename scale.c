@@ -0,0 +1,364 @@
+/* -*- Mode: C; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+/*
+ * scale.c: scaling pixbufs down without reading every pixel of a
+ * huge source image each time.
+ *
+ * Copyright 2026 by Akkana Peck.
+ * You are free to use or modify this code under the Gnu Public License.
+ */
+
+/* Each source pixbuf that gets scaled down by more than half gets
+ * a mip pyramid: copies at 1/2, 1/4, 1/8 ... the size, each made from
+ * the one before with a 2x2 box filter. They're only made as they're
+ * needed, and hang off the source pixbuf with g_object_set_data,
+ * so they last exactly as long as it does: for a master in the image
+ * cache, that means every zoom step on that image can use them.
+ *
+ * A scale then starts from the smallest level that's still at least
+ * as big as the result, so the real scaler never has to read more
+ * than four times as many pixels as it writes.
+ *
+ * The levels add at most a third to the size of the source.
+ * If the source is in the image cache, the cache counts them as
+ * part of its entry (see MipBytes).
+ *
+ * The final scale is split into bands of rows with RunInBands.
+ * If the result is going to be rotated too, each band is scaled a few
+ * rows at a time and each strip rotated into place while it's still
+ * in cache, so there's never a scaled but unrotated copy of the image.
+ * A mirrored source gets flipped the same way, even with no rotation.
+ *
+ * With -Fpho, shrinking uses pho's own filters (resample.c) instead of
+ * gdk_pixbuf_scale, straight from the source: an area average already
+ * looks at every source pixel once, which is all a pyramid level costs.
+ */
+
+#include "pho.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#define MAX_MIP_LEVELS 8
+
+typedef struct {
+    GdkPixbuf* levels[MAX_MIP_LEVELS];   /* levels[0] is 1/2 size */
+} MipPyramid;
+
+static void FreePyramid(gpointer data)
+{
+    MipPyramid* pyr = (MipPyramid*)data;
+    int i;
+
+    for (i = 0; i < MAX_MIP_LEVELS; ++i)
+        if (pyr->levels[i])
+            g_object_unref(pyr->levels[i]);
+    free(pyr);
+}
+
+/* Make a half-size copy of src, averaging each 2x2 block.
+ * An odd last row or column is averaged with itself.
+ */
+static GdkPixbuf* HalvePixbuf(GdkPixbuf* src)
+{
+    int width = gdk_pixbuf_get_width(src);
+    int height = gdk_pixbuf_get_height(src);
+    int newWidth = (width + 1) / 2;
+    int newHeight = (height + 1) / 2;
+    int nchannels = gdk_pixbuf_get_n_channels(src);
+    int srcstride = gdk_pixbuf_get_rowstride(src);
+    int dststride;
+    guchar* srcpixels = gdk_pixbuf_get_pixels(src);
+    guchar* dstpixels;
+    GdkPixbuf* dst;
+    int x, y, i;
+
+    dst = gdk_pixbuf_new(GDK_COLORSPACE_RGB, gdk_pixbuf_get_has_alpha(src),
+                         8, newWidth, newHeight);
+    if (!dst)
+        return 0;
+    dstpixels = gdk_pixbuf_get_pixels(dst);
+    dststride = gdk_pixbuf_get_rowstride(dst);
+
+    for (y = 0; y < newHeight; ++y)
+    {
+        const guchar* row0 = srcpixels + 2 * y * srcstride;
+        const guchar* row1 = (2 * y + 1 < height) ? row0 + srcstride : row0;
+        guchar* out = dstpixels + y * dststride;
+
+        for (x = 0; x < newWidth; ++x)
+        {
+            int x0 = 2 * x * nchannels;
+            int x1 = (2 * x + 1 < width) ? x0 + nchannels : x0;
+
+            for (i = 0; i < nchannels; ++i)
+                *out++ = (row0[x0+i] + row0[x1+i]
+                          + row1[x0+i] + row1[x1+i] + 2) >> 2;
+        }
+    }
+
+    return dst;
+}
+
+/* Return level n (1 = half size) of src's pyramid, making it and
+ * any levels above it if they don't exist yet and make is set.
+ * The pixbuf returned belongs to the pyramid. If a level can't be
+ * made, returns the smallest one there is.
+ */
+static GdkPixbuf* MipLevel(GdkPixbuf* src, int n, int make)
+{
+    MipPyramid* pyr = (MipPyramid*)g_object_get_data(G_OBJECT(src),
+                                                     "pho-mip");
+    GdkPixbuf* level = src;
+    int i;
+
+    if (!pyr) {
+        if (!make)
+            return src;
+        pyr = calloc(1, sizeof (MipPyramid));
+        if (!pyr)
+            return src;
+        g_object_set_data_full(G_OBJECT(src), "pho-mip", pyr, FreePyramid);
+    }
+
+    for (i = 0; i < n && i < MAX_MIP_LEVELS; ++i) {
+        if (!pyr->levels[i]) {
+            if (!make)
+                return level;
+            pyr->levels[i] = HalvePixbuf(level);
+            if (!pyr->levels[i])
+                return level;
+        }
+        level = pyr->levels[i];
+    }
+    return level;
+}
+
+unsigned long MipBytes(GdkPixbuf* src)
+{
+    MipPyramid* pyr = (MipPyramid*)g_object_get_data(G_OBJECT(src),
+                                                     "pho-mip");
+    unsigned long bytes = 0;
+    int i;
+
+    if (!pyr)
+        return 0;
+    for (i = 0; i < MAX_MIP_LEVELS && pyr->levels[i]; ++i)
+        bytes += (unsigned long)gdk_pixbuf_get_rowstride(pyr->levels[i])
+            * gdk_pixbuf_get_height(pyr->levels[i]);
+    return bytes;
+}
+
+/* How many rows of the scaled image to do at a time when rotating:
+ * small enough that they're still in cache when they get rotated.
+ */
+#define STRIP_ROWS 16
+
+typedef struct {
+    GdkPixbuf* src;
+    GdkPixbuf* dst;
+    double scaleX, scaleY;
+    int width, height;      /* scaled size, before rotation */
+    int degrees;
+    int mirror;
+    GdkInterpType interp;
+    Resampler* resampler;   /* or 0 to use gdk_pixbuf_scale */
+    volatile gint failed;
+} ScaleJob;
+
+/* Scale rows firstRow up to endRow of dst. Every band uses the same
+ * offsets and factors, so the bands join up exactly as if the whole
+ * thing had been done at once.
+ */
+static void ScaleRows(gpointer data, int firstRow, int endRow)
+{
+    ScaleJob* job = (ScaleJob*)data;
+
+    if (job->resampler) {
+        int rowstride = gdk_pixbuf_get_rowstride(job->dst);
+        if (!ResampleRows(job->resampler,
+                          gdk_pixbuf_get_pixels(job->dst)
+                          + (long)firstRow * rowstride,
+                          rowstride, firstRow, endRow))
+            g_atomic_int_set(&job->failed, 1);
+        return;
+    }
+
+    gdk_pixbuf_scale(job->src, job->dst,
+                     0, firstRow, gdk_pixbuf_get_width(job->dst),
+                     endRow - firstRow,
+                     0., 0., job->scaleX, job->scaleY, job->interp);
+}
+
+/* Scale rows firstRow up to endRow of the unrotated scaled image
+ * a strip at a time, and rotate each strip to where it goes in dst.
+ * For 90 and 270 a band ends up as a band of columns in dst,
+ * but still doesn't share any pixels with other bands.
+ */
+static void ScaleRotateRows(gpointer data, int firstRow, int endRow)
+{
+    ScaleJob* job = (ScaleJob*)data;
+    int nchannels = gdk_pixbuf_get_n_channels(job->dst);
+    int dstrowstride = gdk_pixbuf_get_rowstride(job->dst);
+    guchar* dstpixels = gdk_pixbuf_get_pixels(job->dst);
+    GdkPixbuf* strip;
+    int y;
+
+    strip = gdk_pixbuf_new(GDK_COLORSPACE_RGB,
+                           gdk_pixbuf_get_has_alpha(job->dst), 8,
+                           job->width, STRIP_ROWS);
+    if (!strip) {
+        g_atomic_int_set(&job->failed, 1);
+        return;
+    }
+
+    for (y = firstRow; y < endRow; y += STRIP_ROWS) {
+        int rows = MIN(STRIP_ROWS, endRow - y);
+        int dstX, dstY;
+
+        if (!job->resampler)
+            gdk_pixbuf_scale(job->src, strip, 0, 0, job->width, rows,
+                             0., (double)-y, job->scaleX, job->scaleY,
+                             job->interp);
+        else if (!ResampleRows(job->resampler, gdk_pixbuf_get_pixels(strip),
+                               gdk_pixbuf_get_rowstride(strip), y, y + rows)) {
+            g_atomic_int_set(&job->failed, 1);
+            break;
+        }
+
+        /* Where rows y up to y+rows of the scaled image end up.
+         * Flipping a strip left to right doesn't move it.
+         */
+        switch (job->degrees)
+        {
+          case 90:
+            dstX = job->height - y - rows;
+            dstY = 0;
+            break;
+          case 270:
+            dstX = y;
+            dstY = 0;
+            break;
+          case 180:
+            dstX = 0;
+            dstY = job->height - y - rows;
+            break;
+          default:    /* 0, mirrored */
+            dstX = 0;
+            dstY = y;
+            break;
+        }
+        RotatePixels(gdk_pixbuf_get_pixels(strip),
+                     gdk_pixbuf_get_rowstride(strip),
+                     job->width, rows, nchannels, job->degrees, job->mirror,
+                     dstpixels + (long)dstY * dstrowstride + dstX * nchannels,
+                     dstrowstride);
+    }
+
+    g_object_unref(strip);
+}
+
+/* quick means nearest neighbour, and no new mip levels */
+static GdkPixbuf* DoScaleRotate(GdkPixbuf* src, int width, int height,
+                                int degrees, int quick)
+{
+    int srcWidth = gdk_pixbuf_get_width(src);
+    int srcHeight = gdk_pixbuf_get_height(src);
+    int n = 0;
+    int ownFilter;
+    GdkPixbuf* from = src;
+    ScaleJob job;
+    gint64 startTime;
+
+    if (degrees != 0 && degrees != 90 && degrees != 180 && degrees != 270) {
+        printf("Illegal rotation value!\n");
+        return 0;
+    }
+
+    /* pho's own filters work straight from src: no pyramid needed */
+    startTime = g_get_monotonic_time();
+    job.resampler = (quick ? 0 : NewResampler(src, width, height));
+    ownFilter = (job.resampler != 0);
+
+    /* How many times can it be halved and still be big enough? */
+    while (!job.resampler && n < MAX_MIP_LEVELS
+           && (srcWidth + 1) / 2 >= width && (srcHeight + 1) / 2 >= height) {
+        srcWidth = (srcWidth + 1) / 2;
+        srcHeight = (srcHeight + 1) / 2;
+        ++n;
+    }
+
+    if (n > 0) {
+        from = MipLevel(src, n, !quick);
+        if (gDebug)
+            printf("Scaling %dx%d to %dx%d from mip level %dx%d (%ld msec)\n",
+                   gdk_pixbuf_get_width(src), gdk_pixbuf_get_height(src),
+                   width, height,
+                   gdk_pixbuf_get_width(from), gdk_pixbuf_get_height(from),
+                   (long)((g_get_monotonic_time() - startTime) / 1000));
+    }
+
+    job.src = from;
+    job.scaleX = (double)width / gdk_pixbuf_get_width(from);
+    job.scaleY = (double)height / gdk_pixbuf_get_height(from);
+    job.width = width;
+    job.height = height;
+    job.degrees = degrees;
+    job.mirror = IsMirrored(src);
+    job.interp = (quick ? GDK_INTERP_NEAREST : GDK_INTERP_BILINEAR);
+    job.failed = 0;
+    if (degrees % 180 != 0)
+        job.dst = gdk_pixbuf_new(GDK_COLORSPACE_RGB,
+                                 gdk_pixbuf_get_has_alpha(from), 8,
+                                 height, width);
+    else
+        job.dst = gdk_pixbuf_new(GDK_COLORSPACE_RGB,
+                                 gdk_pixbuf_get_has_alpha(from), 8,
+                                 width, height);
+    if (!job.dst) {
+        if (job.resampler)
+            FreeResampler(job.resampler);
+        return 0;
+    }
+
+    if (degrees == 0 && !job.mirror)
+        RunInBands(ScaleRows, &job, height, 1);
+    else
+        RunInBands(ScaleRotateRows, &job, height, STRIP_ROWS);
+
+    if (ownFilter)
+        FreeResampler(job.resampler);
+    if (job.failed) {
+        g_object_unref(job.dst);
+        return 0;
+    }
+    if (gDebug)
+        printf("Scaled %dx%d to %dx%d%s, rotated by %d%s, in %ld msec\n",
+               gdk_pixbuf_get_width(src), gdk_pixbuf_get_height(src),
+               width, height,
+               ownFilter ? " (pho filter)" : (quick ? " (quick)" : ""),
+               degrees, job.mirror ? " mirrored" : "",
+               (long)((g_get_monotonic_time() - startTime) / 1000));
+    return job.dst;
+}
+
+GdkPixbuf* ScaleRotatePixbuf(GdkPixbuf* src, int width, int height,
+                             int degrees)
+{
+    return DoScaleRotate(src, width, height, degrees, 0);
+}
+
+GdkPixbuf* QuickScaleRotatePixbuf(GdkPixbuf* src, int width, int height,
+                                  int degrees)
+{
+    return DoScaleRotate(src, width, height, degrees, 1);
+}
+
+/* Like gdk_pixbuf_scale_simple(src, width, height, GDK_INTERP_BILINEAR),
+ * but starting from the closest mip level when shrinking a lot,
+ * and flipping src if it's marked as a mirror image.
+ * Returns a new pixbuf, or 0 if it's out of memory.
+ */
+GdkPixbuf* ScalePixbuf(GdkPixbuf* src, int width, int height)
+{
+    return ScaleRotatePixbuf(src, width, height, 0);
+}
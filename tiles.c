@@ -0,0 +1,218 @@
+/* -*- Mode: C; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+/*
+ * tiles.c: show images zoomed too far to scale all at once,
+ * by scaling only the tiles that are actually on the screen.
+ *
+ * Copyright 2026 by Akkana Peck.
+ * You are free to use or modify this code under the Gnu Public License.
+ */
+
+/* When an image is tiled, gImage is the unscaled source (already
+ * rotated), and gCurImage->curWidth and curHeight are the size of the
+ * virtual, scaled image. DrawImage asks for the tiles that cover the
+ * window, and each one is scaled from the source the first time
+ * it's needed. Only about two screenfuls of tiles are kept, so memory
+ * stays proportional to the screen however far the user zooms in.
+ */
+
+#include "pho.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <gdk/gdk.h>
+
+#define TILE_SIZE 256
+
+/* Only tile if the result would be bigger than the source,
+ * and bigger than this many screens.
+ */
+#define TILE_SCREENS 4
+
+typedef struct Tile_s {
+    int col, row;
+    GdkPixbuf* pixbuf;
+    struct Tile_s* next;
+} Tile;
+
+static GdkPixbuf* sSource = 0;
+static int sWidth = 0, sHeight = 0;     /* size of the scaled image */
+static Tile* sTiles = 0;                /* most recently used first */
+static int sNumTiles = 0;
+
+static int MaxTiles()
+{
+    int cols = (gPhysMonitorWidth + TILE_SIZE - 1) / TILE_SIZE + 1;
+    int rows = (gPhysMonitorHeight + TILE_SIZE - 1) / TILE_SIZE + 1;
+    return cols * rows * 2;
+}
+
+static void FreeTiles()
+{
+    while (sTiles) {
+        Tile* next = sTiles->next;
+        g_object_unref(sTiles->pixbuf);
+        free(sTiles);
+        sTiles = next;
+    }
+    sNumTiles = 0;
+}
+
+int TooBigToScale(PhoScaleParams* params, int width, int height,
+                  int srcWidth, int srcHeight)
+{
+    double area = (double)width * height;
+    return (area > (double)srcWidth * srcHeight
+            && area > TILE_SCREENS * (double)params->monitorWidth
+                                   * params->monitorHeight);
+}
+
+void TilesClear()
+{
+    FreeTiles();
+    if (sSource) {
+        g_object_unref(sSource);
+        sSource = 0;
+    }
+    sWidth = sHeight = 0;
+}
+
+int TilesActive()
+{
+    /* If gImage has changed, whatever we were tiling is gone,
+     * so don't hang on to it.
+     */
+    if (sSource && sSource != gImage)
+        TilesClear();
+    return (sSource != 0);
+}
+
+void TilesSetSource(GdkPixbuf* src, int width, int height)
+{
+    if (src == sSource && width == sWidth && height == sHeight)
+        return;
+
+    TilesClear();
+    sSource = g_object_ref(src);
+    sWidth = width;
+    sHeight = height;
+    if (gDebug)
+        printf("Tiling %dx%d image from %dx%d\n", width, height,
+               gdk_pixbuf_get_width(src), gdk_pixbuf_get_height(src));
+}
+
+/* Find a tile, scaling it from the source if we don't have it. */
+static Tile* GetTile(int col, int row)
+{
+    Tile** tp;
+    Tile* tile;
+    int x = col * TILE_SIZE;
+    int y = row * TILE_SIZE;
+    int width = sWidth - x;
+    int height = sHeight - y;
+
+    for (tp = &sTiles; *tp; tp = &((*tp)->next)) {
+        tile = *tp;
+        if (tile->col == col && tile->row == row) {
+            /* Move it to the front */
+            *tp = tile->next;
+            tile->next = sTiles;
+            sTiles = tile;
+            return tile;
+        }
+    }
+
+    if (width > TILE_SIZE)
+        width = TILE_SIZE;
+    if (height > TILE_SIZE)
+        height = TILE_SIZE;
+
+    tile = calloc(1, sizeof (Tile));
+    if (!tile)
+        return 0;
+    tile->pixbuf = gdk_pixbuf_new(GDK_COLORSPACE_RGB,
+                                  gdk_pixbuf_get_has_alpha(sSource), 8,
+                                  width, height);
+    if (!tile->pixbuf) {
+        free(tile);
+        return 0;
+    }
+    gdk_pixbuf_scale(sSource, tile->pixbuf, 0, 0, width, height,
+                     (double)-x, (double)-y,
+                     (double)sWidth / gdk_pixbuf_get_width(sSource),
+                     (double)sHeight / gdk_pixbuf_get_height(sSource),
+                     GDK_INTERP_BILINEAR);
+    tile->col = col;
+    tile->row = row;
+    tile->next = sTiles;
+    sTiles = tile;
+    ++sNumTiles;
+
+    /* Throw out the least recently used ones, never the new one */
+    if (sNumTiles > MaxTiles()) {
+        Tile* last = sTiles;
+        int n = 1;
+        while (last->next && n < MaxTiles()) {
+            last = last->next;
+            ++n;
+        }
+        while (last->next) {
+            Tile* dead = last->next;
+            last->next = dead->next;
+            g_object_unref(dead->pixbuf);
+            free(dead);
+            --sNumTiles;
+        }
+    }
+
+    return tile;
+}
+
+void DrawTiles(GdkDrawable* drawable, GdkGC* gc, int originX, int originY,
+               int areaX, int areaY, int areaWidth, int areaHeight)
+{
+    int x0, y0, x1, y1, col, row;
+
+    if (!TilesActive())
+        return;
+
+    /* The part of the scaled image that's inside the area */
+    x0 = areaX - originX;
+    y0 = areaY - originY;
+    x1 = x0 + areaWidth;
+    y1 = y0 + areaHeight;
+    if (x0 < 0) x0 = 0;
+    if (y0 < 0) y0 = 0;
+    if (x1 > sWidth) x1 = sWidth;
+    if (y1 > sHeight) y1 = sHeight;
+    if (x1 <= x0 || y1 <= y0)
+        return;
+
+    for (row = y0 / TILE_SIZE; row * TILE_SIZE < y1; ++row) {
+        for (col = x0 / TILE_SIZE; col * TILE_SIZE < x1; ++col) {
+            Tile* tile = GetTile(col, row);
+            int tileX = col * TILE_SIZE;
+            int tileY = row * TILE_SIZE;
+            int sx, sy, ex, ey;
+
+            if (!tile)
+                continue;
+
+            /* Just the part of the tile that's inside the area */
+            sx = (x0 > tileX) ? x0 - tileX : 0;
+            sy = (y0 > tileY) ? y0 - tileY : 0;
+            ex = x1 - tileX;
+            ey = y1 - tileY;
+            if (ex > gdk_pixbuf_get_width(tile->pixbuf))
+                ex = gdk_pixbuf_get_width(tile->pixbuf);
+            if (ey > gdk_pixbuf_get_height(tile->pixbuf))
+                ey = gdk_pixbuf_get_height(tile->pixbuf);
+
+            gdk_pixbuf_render_to_drawable(tile->pixbuf, drawable, gc,
+                                          sx, sy,
+                                          originX + tileX + sx,
+                                          originY + tileY + sy,
+                                          ex - sx, ey - sy,
+                                          GDK_RGB_DITHER_NONE, 0, 0);
+        }
+    }
+}
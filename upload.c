@@ -0,0 +1,172 @@
+/* -*- Mode: C; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+/*
+ * upload.c: getting pixels to the X server through shared memory.
+ *
+ * Copyright 2026 by Akkana Peck.
+ * You are free to use or modify this code under the Gnu Public License.
+ */
+
+/* gdk_pixbuf_render_to_drawable converts pixels and sends them to the
+ * server a small piece at a time. With the MIT-SHM extension, it's
+ * quicker to convert them straight into one shared memory image and
+ * have the server copy the whole thing in one request.
+ *
+ * That's only done for the usual 24-bit TrueColor visuals with 8 bits
+ * per color and 4 bytes per pixel, and for pixbufs without alpha.
+ * Anything else falls back to gdk_pixbuf_render_to_drawable, and so
+ * does everything if the first shared image can't be made, which is
+ * what happens when there's no MIT-SHM (e.g. a remote display).
+ *
+ * The server reads the shared image whenever it gets to the request,
+ * so before the image is written again, gdk_flush() has to make sure
+ * the server is finished with it.
+ */
+
+#include "pho.h"
+
+#include <stdio.h>
+#include <gdk/gdk.h>
+
+static GdkImage* sShmImage = 0;
+static int sShmWorked = 0;    /* made a shared image at least once */
+static int sShmFailed = 0;    /* no MIT-SHM: don't keep trying */
+static int sShmBusy = 0;      /* the server may still be reading it */
+
+typedef struct {
+    const guchar* src;
+    int srcrowstride, srcchannels;
+    guchar* dst;
+    int dstrowstride;
+    int width;
+    int redShift, greenShift, blueShift;
+    int lsbFirst;
+} ConvertJob;
+
+static int FastVisual(GdkVisual* visual)
+{
+    /* Not a 32-bit ARGB visual: ConvertRows leaves the top byte 0 */
+    return visual && visual->type == GDK_VISUAL_TRUE_COLOR
+        && visual->depth == 24 && visual->red_prec == 8 && visual->green_prec == 8
+        && visual->blue_prec == 8;
+}
+
+/* Return a shared image at least width x height for visual,
+ * which the server isn't using, or 0.
+ */
+static GdkImage* GetShmImage(GdkVisual* visual, int width, int height)
+{
+    if (sShmImage && (sShmImage->visual != visual
+                      || sShmImage->width < width
+                      || sShmImage->height < height)) {
+        /* Don't pull it out from under the server */
+        if (sShmBusy)
+            gdk_flush();
+        sShmBusy = 0;
+        if (sShmImage->visual == visual) {
+            width = MAX(width, sShmImage->width);
+            height = MAX(height, sShmImage->height);
+        }
+        g_object_unref(sShmImage);
+        sShmImage = 0;
+    }
+
+    if (!sShmImage) {
+        sShmImage = gdk_image_new(GDK_IMAGE_SHARED, visual, width, height);
+        if (sShmImage && sShmImage->bpp != 4) {
+            g_object_unref(sShmImage);
+            sShmImage = 0;
+            sShmFailed = 1;
+        }
+        if (!sShmImage) {
+            /* If it never worked, it never will */
+            if (!sShmWorked)
+                sShmFailed = 1;
+            if (gDebug)
+                printf("No %dx%d shared image: using gdk to draw\n",
+                       width, height);
+            return 0;
+        }
+        sShmWorked = 1;
+    }
+
+    if (sShmBusy) {
+        gdk_flush();
+        sShmBusy = 0;
+    }
+    return sShmImage;
+}
+
+static void ConvertRows(gpointer data, int firstRow, int endRow)
+{
+    ConvertJob* job = (ConvertJob*)data;
+    int x, y;
+
+    for (y = firstRow; y < endRow; ++y) {
+        const guchar* src = job->src + (long)y * job->srcrowstride;
+        guchar* dst = job->dst + (long)y * job->dstrowstride;
+
+        for (x = 0; x < job->width; ++x) {
+            guint32 pixel = ((guint32)src[0] << job->redShift)
+                            | ((guint32)src[1] << job->greenShift)
+                            | ((guint32)src[2] << job->blueShift);
+            if (job->lsbFirst) {
+                dst[0] = pixel;
+                dst[1] = pixel >> 8;
+                dst[2] = pixel >> 16;
+                dst[3] = pixel >> 24;
+            }
+            else {
+                dst[0] = pixel >> 24;
+                dst[1] = pixel >> 16;
+                dst[2] = pixel >> 8;
+                dst[3] = pixel;
+            }
+            src += job->srcchannels;
+            dst += 4;
+        }
+    }
+}
+
+void UploadPixbuf(GdkPixbuf* pix, GdkDrawable* drawable, GdkGC* gc,
+                  int srcX, int srcY, int dstX, int dstY,
+                  int width, int height)
+{
+    GdkVisual* visual = 0;
+    GdkImage* image = 0;
+    ConvertJob job;
+    gint64 startTime = g_get_monotonic_time();
+
+    if (width < 1 || height < 1)
+        return;
+
+    if (!sShmFailed && !gdk_pixbuf_get_has_alpha(pix)
+        && FastVisual(visual = gdk_drawable_get_visual(drawable)))
+        image = GetShmImage(visual, width, height);
+    if (!image) {
+        gdk_pixbuf_render_to_drawable(pix, drawable, gc, srcX, srcY,
+                                      dstX, dstY, width, height,
+                                      GDK_RGB_DITHER_NONE, 0, 0);
+        return;
+    }
+
+    job.srcrowstride = gdk_pixbuf_get_rowstride(pix);
+    job.srcchannels = gdk_pixbuf_get_n_channels(pix);
+    job.src = gdk_pixbuf_get_pixels(pix) + (long)srcY * job.srcrowstride
+              + srcX * job.srcchannels;
+    job.dst = image->mem;
+    job.dstrowstride = image->bpl;
+    job.width = width;
+    job.redShift = visual->red_shift;
+    job.greenShift = visual->green_shift;
+    job.blueShift = visual->blue_shift;
+    job.lsbFirst = (image->byte_order == GDK_LSB_FIRST);
+    RunInBands(ConvertRows, &job, height, 1);
+
+    gdk_draw_image(drawable, gc, image, 0, 0, dstX, dstY, width, height);
+    sShmBusy = 1;
+
+    if (gDebug)
+        printf("Sent %dx%d through shared memory in %ld msec\n",
+               width, height,
+               (long)((g_get_monotonic_time() - startTime) / 1000));
+}